@@ -4,6 +4,18 @@
 #define PWD ""
 #define VERSION ""
 #define APP ""
+
+// Servers merged into one library: { name, url, port, user, password }
+// Artists are matched by name and albums by MusicBrainz ID, or by name and year, so
+// an album on several servers is listed once and streamed from the closest one.
+// The first server holds the playlists and the play queue.
+static const Server servers[] = {
+    { "default", URL, PORT, USER, PWD },
+};
+
+// Authenticate with a salted MD5 token (API 1.13.0 and later) instead of sending the
+// password with every request; set to 0 for servers that only accept the password
+static const int token_auth = 1;
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
@@ -28,7 +40,9 @@ const unsigned int bottom_space = 4;
 /* Actions */
 enum { play_pause, stop, next, previous, repeat, shuffle, quit, add,
        add_and_play, remove_one, remove_all, main_view, playlist_view, up, down,
-       left, right, resize, bottom, top, chord, search, search_next, search_previous
+       left, right, resize, bottom, top, chord, search, search_next, search_previous,
+       crop, visual, move_up, move_down, next_playlist, previous_playlist,
+       save_playlist, new_playlist
 };
 
 static const int keys[][2] = {
@@ -45,6 +59,16 @@ static const int keys[][2] = {
     {KEY_ENTER,         add_and_play},
     {'d',               remove_one},
     {'c',               remove_all},
+    {'C',               crop},
+    {'v',               visual},
+    {'K',               move_up},
+    {KEY_SR,            move_up},
+    {'J',               move_down},
+    {KEY_SF,            move_down},
+    {']',               next_playlist},
+    {'[',               previous_playlist},
+    {'S',               save_playlist},
+    {'N',               new_playlist},
     {'1',               main_view},
     {'2',               playlist_view},
     {KEY_UP,            up},
@@ -71,10 +95,53 @@ static const int len_chords = sizeof(chords)/sizeof(chords[0]);
 static char *const executable = "ffplay";
 static char *const flags = "-nodisp -autoexit";
 
-// Define the variable to use for notification
+// Transcoding profiles requested from the server, from lowest to highest quality.
+// Between tracks the stream steps up or down this list, based on the measured
+// throughput and on how close playback came to running out of buffered audio.
+// A bitrate of 0 requests the original file.
+static const TranscodeProfile profiles[] = {
+    /* Format,  Max bitrate (kbps) */
+    {"mp3",     96},
+    {"mp3",     128},
+    {"mp3",     192},
+    {"mp3",     320},
+    {"raw",     0},
+};
+static const int initial_profile = 2;       /* Profile used until throughput is measured */
+static const int original_bitrate = 1411;   /* Bitrate assumed for original files, in kbps */
+static const double bitrate_headroom = 1.5; /* Throughput needed over a bitrate to step up */
+static const int min_buffer_seconds = 5;    /* Step down when buffered audio drops below this */
+static const int max_buffer_seconds = 60;   /* Stop downloading ahead past this much audio */
+
+// Show a notification when a song starts, through the desktop notification service
+// Each notification replaces the previous one instead of stacking up
+static const int desktop_notifications = 0;
+
+// Define the variable to use for notification, run with the summary and the body as
+// arguments when no notification service is available (no shell, split on spaces)
 // Use NULL if this is unwanted
 static char *const notify_cmd = NULL;
 
+// Journal keeping the queue and playback position between sessions
+// Relative paths are resolved in $XDG_STATE_HOME/sksonic (~/.local/state/sksonic)
+// Use NULL if this is unwanted
+static char *const queue_journal = "queue";
+static const int journal_compact_records = 1024; /* Changes logged before the journal is compacted, at least */
+static const int journal_position_interval = 10; /* Seconds between position records during playback */
+
+// Also save the queue on the server with savePlayQueue when quitting,
+// and restore it with getPlayQueue when there is no local journal
+static const int sync_play_queue = 0;
+
+// Unix socket accepting line-delimited JSON commands and pushing state events
+// Relative paths are resolved in $XDG_RUNTIME_DIR/sksonic
+// Use NULL if this is unwanted
+static char *const control_socket = "control";
+
+// Expose playback on the session bus as an MPRIS player (org.mpris.MediaPlayer2.sksonic),
+// for media keys and desktop widgets
+static const int enable_mpris = 1;
+
 // Location where AppState is dumped at every song change
 // Other programs can read that file and display the information
 // Use NULL if this is unwanted
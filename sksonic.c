@@ -1,4 +1,7 @@
+#define _GNU_SOURCE
 #include <stdint.h>
+#include <ctype.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -7,15 +10,47 @@
 #include <signal.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include <curl/curl.h>
 #include "cJSON.c"
 
 #include <ncurses.h>
+
+typedef struct TranscodeProfile {
+    const char *format;
+    int max_bitrate;
+} TranscodeProfile;
+
+typedef struct Server {
+    const char *name;
+    const char *url;
+    int port;
+    const char *user;
+    const char *password;
+} Server;
+
 #include "config.h"
 #define HASH_TABLE_SIZE 1024
-#define NOTIFICATION_LENGTH 1024
 #define MAX_QUERY_LENGTH 256
+#define SHUFFLE_HISTORY_LENGTH 1024
+#define THROUGHPUT_SMOOTHING 0.3
+#define THROUGHPUT_WINDOW 2.0
+#define THROUGHPUT_MIN_BYTES 65536
+#define JOURNAL_BATCH_DELAY 0.2
+#define CONTROL_BUFFER_LIMIT (1 << 20)
+#define MPRIS_PATH "/org/mpris/MediaPlayer2"
+#define MPRIS_INTERFACE "org.mpris.MediaPlayer2"
+#define MPRIS_PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
 
 typedef enum {
     PANEL_ARTISTS,
@@ -56,33 +91,86 @@ typedef enum {
     NUM_VIEWS
 } ViewType;
 
-typedef struct {
+typedef struct BandwidthEstimator {
+    pthread_mutex_t lock;
+    double throughput;          /* Smoothed download throughput in kbps */
+    int samples;                /* Number of throughput samples taken */
+    int profile;                /* Index of the profile used for the current track */
+    double min_buffer;          /* Lowest buffered seconds seen during the current track */
+} BandwidthEstimator;
+
+typedef struct Stream {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
     char *url;
     char *command;
-    int playlist_pid;
-} PlaybackThreadArgs;
+    int fd;                     /* Anonymous spool file holding the downloaded audio */
+    off_t downloaded;           /* Bytes written to the spool file */
+    int complete;               /* The download has finished, successfully or not */
+    int cancelled;              /* The track was skipped or playback stopped */
+    int references;             /* Held by the download and feeder threads */
+    int duration;               /* Song duration in seconds */
+    int bitrate;                /* Requested bitrate in kbps, 0 for the original file */
+    double bytes_per_second;    /* Playback consumption rate */
+    double played;              /* Seconds played so far, updated by the main loop */
+    int offset;                 /* Seconds of the song skipped by the server, for resuming */
+    BandwidthEstimator *bandwidth;
+    CURL *curl;                 /* Download handle, only used by the download thread */
+    double window_start;        /* Start of the current throughput sampling window */
+    double window_idle;         /* Time spent throttled within the window */
+    double window_bytes;        /* Bytes received within the window */
+} Stream;
+
+enum Operation {
+    PING,
+    ARTISTS,
+    ALBUMS,
+    SONGS,
+    PLAY,
+    PLAYLISTS,
+    PLAYLIST,
+    CREATE_PLAYLIST,
+    UPDATE_PLAYLIST,
+    SAVE_PLAY_QUEUE,
+    GET_PLAY_QUEUE,
+    SEARCH,
+    SONG,
+    NUMBER_OPERATIONS
+};
 
 typedef struct Connection {
+    const char *name;
     char *url;
     int port;
     char *user;
     char *password;
     char *version;
     char *app;
+    const TranscodeProfile *profiles;
+    int number_profiles;
+    BandwidthEstimator *bandwidth;
+    char salt[17];              /* Random salt of the session, for token authentication */
+    char token[33];             /* MD5 of the password and the salt */
+    char *requests[NUMBER_OPERATIONS];  /* URL of each operation, up to its parameters */
+    int request_lengths[NUMBER_OPERATIONS];
+    double latency;             /* Round trip of a ping in seconds, -1 if unreachable */
 } Connection;
 
-enum Operation {
-    PING,
-    ARTISTS,
-    ALBUMS,
-    SONGS,
-    PLAY
-};
+/* Copy of an artist, album or song on another server */
+typedef struct Source {
+    const Connection *connection;
+    char *id;
+} Source;
 
 typedef struct Song {
     char *id;
     char *name;
+    char *artist;
+    char *album;
     int duration;
+    const Connection *origin;   /* Server the ID belongs to */
+    Source *copies;             /* The same song on other servers */
+    int number_copies;
 } Song;
 
 typedef struct Album {
@@ -90,6 +178,9 @@ typedef struct Album {
     char *name;
     int number_songs;
     Song *songs;
+    const Connection *origin;
+    Source *copies;
+    int number_copies;
 } Album;
 
 typedef struct Artist {
@@ -97,6 +188,9 @@ typedef struct Artist {
     char *id;
     int number_albums;
     Album *albums;
+    const Connection *origin;
+    Source *copies;
+    int number_copies;
 } Artist;
 
 typedef struct Database {
@@ -104,13 +198,50 @@ typedef struct Database {
     int number_artists;
 } Database;
 
+typedef struct PlaylistNode {
+    Song *song;
+    int left;
+    int right;
+    int parent;
+    int size;                   /* Number of songs in the subtree rooted at this node */
+    unsigned int priority;      /* Random heap priority that keeps the tree balanced */
+    unsigned int generation;    /* Bumped whenever the node is released */
+} PlaylistNode;
+
+typedef struct ShuffleHistoryEntry {
+    int node;
+    unsigned int generation;    /* Tells apart a node reused after its song was removed */
+} ShuffleHistoryEntry;
+
+/* Shuffle order as a Fisher-Yates permutation of playlist nodes, maintained incrementally.
+ * `upcoming` holds the nodes not played in the current cycle, the next one last, and
+ * `position` maps each node back to its slot so removals take O(1). */
+typedef struct ShuffleOrder {
+    int *upcoming;
+    int number_upcoming;
+    int *position;
+    ShuffleHistoryEntry *history;
+    int number_history;
+    unsigned int seed;
+} ShuffleOrder;
+
+/* Songs are kept in an implicit treap so that positional insert, delete and move
+ * cost O(log n). Nodes live in a pool addressed by index; node 0 is the empty tree. */
 typedef struct Playlist {
-    Song **songs;
-    int size;
+    PlaylistNode *nodes;
+    int root;
+    int free_node;              /* Head of the list of released nodes */
+    int used;                   /* Nodes handed out from the pool so far */
     int capacity;
+    int playing_node;           /* Node of the current song, 0 if it was removed */
+    ShuffleOrder shuffle;
+    int size;
+    unsigned int version;       /* Bumped on every change to the contents */
+    struct Journal *journal;    /* Log of the changes to the queue, NULL if not persisted */
     int current_playing;
     time_t start_time;
     int play_time;
+    int resume_position;        /* Seconds into the current song to resume from, -1 if none */
     int status;
     int repeat_shuffle;
     int selected_song_idx;
@@ -119,6 +250,23 @@ typedef struct Playlist {
 } Playlist;
 
 
+/* Playlist stored on the server, edited locally and synced back as a diff */
+typedef struct NamedPlaylist {
+    char *id;                   /* Server ID, NULL until the playlist is created */
+    char *name;
+    int number_songs;           /* Song count reported by getPlaylists */
+    int loaded;                 /* Entries have been fetched with getPlaylist */
+    Playlist songs;
+    char **synced;              /* Song IDs as last seen on the server */
+    int number_synced;
+    unsigned int synced_version; /* Version of `songs` matching `synced` */
+} NamedPlaylist;
+
+typedef struct SongEntry {
+    Song song;
+    struct SongEntry *next;
+} SongEntry;
+
 typedef struct SongInfo {
     const char *artist;
     const char *album;
@@ -141,6 +289,10 @@ typedef struct AppState {
     int selected_artist_idx;
     int selected_album_idx;
     int selected_song_idx;
+    int selection_anchor;       /* Row where the visual selection starts, -1 if none */
+    NamedPlaylist *playlists;
+    int number_playlists;
+    int viewed_playlist;        /* Named playlist shown in the playlist view, -1 for the queue */
     WINDOW **windows[NUM_WINDOWS];
 } AppState;
 
@@ -149,6 +301,99 @@ struct url_data {
     char *data;
 };
 
+/* Append-only log of the changes to the queue, written and fsync'd by a background thread.
+ * The UI thread only formats records into `pending`; once enough records pile up, the whole
+ * queue is handed over as a snapshot that atomically replaces the file. */
+typedef struct Journal {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    char *path;
+    int fd;
+    struct url_data pending;    /* Records not written yet */
+    struct url_data snapshot;   /* Compacted queue replacing the file, if its size is not 0 */
+    int records;                /* Records logged since the last compaction */
+    int logged_position;        /* Playback position in the last position record */
+    int stopping;
+} Journal;
+
+/* Client of the control socket */
+typedef struct ControlClient {
+    int fd;
+    int id;
+    int subscribed;             /* Receives the state events */
+    struct url_data input;      /* Command line not received completely */
+    struct url_data output;     /* Replies and events not sent yet */
+} ControlClient;
+
+/* Command received on the control socket, carried out by the UI thread */
+typedef struct ControlCommand {
+    int client;
+    cJSON *request;
+    cJSON *song;                /* Song entry fetched for "enqueue", or NULL */
+    struct ControlCommand *next;
+} ControlCommand;
+
+/* Unix socket server reading line-delimited JSON commands. Its thread serves the clients
+ * and makes the server requests; commands touching the player are queued for the UI
+ * thread, which is woken up through `wakeup`. */
+typedef struct ControlServer {
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int started;
+    int stopping;
+    char *path;
+    int listen_fd;
+    int wakeup[2];              /* Written when commands are queued for the UI thread */
+    int notify[2];              /* Written when messages are queued for the clients */
+    const Connection *connection;
+    ControlClient *clients;     /* Changed by the control thread only */
+    int number_clients;
+    int next_client;
+    ControlCommand *commands;   /* Commands not carried out yet, oldest first */
+    ControlCommand **last_command;
+} ControlServer;
+
+/* Connection to a D-Bus message bus */
+typedef struct Bus {
+    int fd;
+    uint32_t serial;            /* Serial of the last message sent */
+    uint32_t name_serial;       /* Serial of the pending RequestName call, 0 if none */
+    struct url_data input;      /* Received bytes not handled yet */
+} Bus;
+
+/* Background writer of the state_dump file, keeping only the latest state */
+typedef struct StatePublisher {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int started;
+    int stopping;
+    struct url_data pending;    /* Latest state not written yet, NULL data if none */
+} StatePublisher;
+
+/* Background sender of the desktop notifications, keeping only the latest one */
+typedef struct Notifier {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int started;
+    int stopping;
+    char *summary;              /* Notification not shown yet, NULL if none */
+    char *text;
+} Notifier;
+
+/* Request to one of the servers, sent with the others by fetch_concurrently() */
+typedef struct Fetch {
+    const Connection *connection;
+    char *url;
+    cJSON *root;                /* Parsed response, freed by free_fetches() */
+    cJSON *response;            /* The "subsonic-response" object, NULL on failure */
+    double seconds;             /* Time taken by the request */
+    pthread_t thread;
+    int threaded;
+} Fetch;
+
 /* Functions */
 int write_url_data(void *const, const int, const int, struct url_data *const);
 void pause_resume(const AppState *const);
@@ -156,34 +401,164 @@ void stop_playback(const AppState *const);
 void generate_subsonic_url(const Connection *, enum Operation, const char *, 
                            char **);
 void add_song(const Song *, Playlist *);
+void reserve_songs(Playlist *const, const int);
+void insert_songs(Playlist *const, const int, Song *const *const, const int);
+void remove_songs(Playlist *const, const int, const int);
+void move_songs(Playlist *const, const int, const int, const int);
+void clear_songs(Playlist *const);
+void append_format(struct url_data *const, const char *const, ...);
+void log_record(Playlist *const, Song *const *const, const int,
+                const char *const, ...);
+void log_position(Playlist *const);
+void compact_journal(Playlist *const);
+char *state_path(const char *const);
+void replay_journal(Playlist *const, const char *const);
+void open_journal(Playlist *const, const char *const);
+void close_journal(Playlist *const);
+void save_play_queue(const AppState *const);
+void get_play_queue(AppState *const);
+Song *playlist_song(const Playlist *const, const int);
+int song_node(const Playlist *const, int);
+int song_position(const Playlist *const, int);
+int next_node(const Playlist *const, int);
+int shuffle_next(Playlist *const);
+int shuffle_previous(Playlist *const);
+int upcoming_songs(const Playlist *const, int *const, const int);
 void delete_song(const AppState *const);
-void get_artists(const Connection *, Database *);
-void get_albums(const Connection *const, const Database *const, 
-        const char *const);
-void get_songs(const Connection *const, const Database *const, const char *, const char *);
+void delete_songs(const AppState *const, const int, const int);
+void clear_playlist(const AppState *const);
+void crop_playlist(const AppState *const);
+int get_library(Database *const);
+void get_albums(const Database *const, const char *const);
+void get_songs(const Database *const, const char *, const char *);
 void notify(const AppState *);
-void request_albums(const Connection *const, Artist *const);
-void request_songs(const Connection *, Album *);
+void dump(const AppState *const);
+void stop_publisher(void);
+cJSON *state_object(const AppState *const);
+char *runtime_path(const char *const);
+void control_send(const int, const cJSON *const);
+void start_control(const Connection *const, const char *const);
+int playback_command(AppState *const, const char *const);
+void process_control_commands(AppState *const);
+void stop_control(void);
+void handle_action(const int, AppState *);
+void append_bytes(struct url_data *const, const void *const, const int);
+uint32_t bus_send(Bus *const, const int, const char *const, const char *const,
+                  const char *const, const char *const, const char *const,
+                  const uint32_t, const char *const, const struct url_data *const);
+int bus_connect(Bus *const);
+int bus_receive(Bus *const);
+void bus_close(Bus *const);
+void mpris_changed(const AppState *const);
+void start_mpris(void);
+void process_bus(AppState *const);
+void *notifier_thread(void *const);
+void stop_notifier(void);
+void request_albums(Artist *const);
+void request_songs(Album *);
 void print_window_data(const AppState *const, PanelType, WINDOW *const *const);
 void change_playback_status(const pid_t, const int);
-int add_to_playlist(AppState *);
+int add_to_playlist(AppState *, Playlist *const);
+void play_viewed_playlist(AppState *const);
+int prompt_text(const AppState *const, const char *const, char *const,
+                const int);
 char *fetch_url_data(const char *const);
+char *post_url_data(const char *const, const char *const);
+void generate_subsonic_query(const Connection *const, enum Operation,
+                             const char *, char **);
+void append_query(struct url_data *const, const char *const,
+                  const char *const);
+const char *json_string_value(const cJSON *const, const char *const,
+                              const char *const);
+char *json_string(const cJSON *const, const char *const, const char *const);
+int json_int(const cJSON *const, const char *const, const int);
+cJSON *request_subsonic(const char *const, const char *const, cJSON **const);
+Song *intern_song_data(const Song *const);
+Song *intern_song(const cJSON *const);
+void get_playlists(AppState *const);
+void request_playlist(const Connection *const, NamedPlaylist *const);
+int sync_playlist(const Connection *const, NamedPlaylist *const);
+int create_named_playlist(AppState *const, const char *const,
+                          const Playlist *const);
+Playlist *viewed_playlist(const AppState *const);
+void switch_playlist(AppState *const, const int);
 Database init_db(void);
 AppState init_appstate(void);
 Playlist init_playlist(void);
 WINDOW **create_windows(const int, const int, const WindowType);
 void play_song(const AppState *const, const int);
+int choose_profile(const Connection *const);
+void md5_hex(const char *const, char[33]);
+void init_connection(Connection *const);
+void init_connections(void);
+void fetch_concurrently(Fetch *const, const int);
+void free_fetches(Fetch *const, const int);
+Fetch *source_fetches(const enum Operation, const Connection *const, const char *const,
+                      const Source *const, const int);
+void add_copy(Source **const, int *const, const Connection *const, const char *const);
+unsigned long text_hash(const char *const);
+const char *song_id(const Song *const, const Connection *const);
+Source song_source(const Song *const);
+const Connection *find_connection(const char *const);
+void free_copies(Source *const, const int);
+int same_album(const cJSON *const, const cJSON *const);
+int same_song(const cJSON *const, const cJSON *const);
+char *generate_stream_url(const Connection *const, const char *const,
+                          const TranscodeProfile *const, const int);
+Stream *open_stream(char *const, char *const, const int, const int,
+                    const int, BandwidthEstimator *const);
+void cancel_stream(void);
+void observe_stream(const int);
 void search_idx(AppState *);
+void selection_range(const AppState *const, int *const, int *const);
+void toggle_selection(AppState *const);
+void move_selection(AppState *const, const int);
+
+/* Servers merged into the library, built from `servers` at startup. The first one
+ * holds the playlists and the play queue. */
+static Connection *connections = NULL;
+static int number_connections = 0;
+
+/* Writer of the state_dump file, started on the first dump */
+static StatePublisher state_publisher = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .started = 0,
+    .stopping = 0,
+    .pending = { 0, NULL },
+};
+
+/* Sender of the notifications, started on the first one */
+static Notifier desktop_notifier = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .started = 0,
+    .stopping = 0,
+    .summary = NULL,
+    .text = NULL,
+};
 
-static const Connection connection = {
-    .url = URL,
-    .port = PORT,
-    .user = USER,
-    .password = PWD,
-    .version = VERSION,
-    .app = APP
+/* Control socket, started if control_socket is set */
+static ControlServer control_server = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .started = 0,
+    .stopping = 0,
+    .listen_fd = -1,
+    .wakeup = { -1, -1 },
+    .notify = { -1, -1 },
+    .commands = NULL,
+    .last_command = NULL,
 };
 
+/* Session bus connection exposing the MPRIS player, -1 if not connected */
+static Bus session_bus = { .fd = -1 };
+
+/* Songs known only from playlists, interned by ID */
+static SongEntry *song_table[HASH_TABLE_SIZE] = { NULL };
+
+/* Stream of the song currently playing, owned by the UI thread */
+static Stream *current_stream = NULL;
+
 /**
  * Function to initialize the app state.
  *
@@ -197,10 +572,14 @@ AppState init_appstate(void)
         .selected_artist_idx = 0,
         .selected_album_idx = 0,
         .selected_song_idx = 0,
+        .selection_anchor = -1,
+        .playlists = NULL,
+        .number_playlists = 0,
+        .viewed_playlist = -1,
         .current_view = VIEW_INFO,
         .current_panel = PANEL_ARTISTS,
         .playlist = NULL,
-        .connection = &connection,
+        .connection = &connections[0],
         .program = program,
         .db = NULL,
         .artist = NULL,
@@ -225,34 +604,389 @@ static inline void delete_windows(WINDOW *windows[], const int num_windows)
 }
 
 /**
- * Function that runs in a separate thread to play the song using ffplay.
+ * Returns the current time of the monotonic clock in seconds.
  *
- * @param arg Pointer to a PlaybackThreadArgs struct containing data needed to run the playback.
+ * @return Seconds elapsed since an arbitrary, fixed point in the past.
  */
-void *playback_thread(void *arg)
+static double monotonic_seconds(void)
 {
-    // Get arguments and free memory associated with them.
-    PlaybackThreadArgs *const args = (PlaybackThreadArgs *) arg;
-    char *const url = args->url;
-    char *const command = args->command;
+    struct timespec now;
 
-    free(args);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
 
-    // Open a pipe for reading from the ffplay process.
-    FILE *const fp = popen(command, "r");
+/**
+ * Returns the bitrate in kbps that a transcoding profile needs to play without stalling.
+ *
+ * @param profile The transcoding profile.
+ * @return The profile bitrate, or the assumed bitrate of original files if it does not transcode.
+ */
+static int profile_bitrate(const TranscodeProfile *const profile)
+{
+    return profile->max_bitrate > 0 ? profile->max_bitrate : original_bitrate;
+}
+
+/**
+ * Adds a throughput sample to the bandwidth estimator of a connection.
+ *
+ * @param bandwidth The estimator to update.
+ * @param kbps      The measured throughput in kbps.
+ */
+static void record_throughput(BandwidthEstimator *const bandwidth, const double kbps)
+{
+    pthread_mutex_lock(&bandwidth->lock);
+    bandwidth->throughput = bandwidth->samples == 0 ? kbps :
+        THROUGHPUT_SMOOTHING * kbps +
+        (1 - THROUGHPUT_SMOOTHING) * bandwidth->throughput;
+    bandwidth->samples++;
+    pthread_mutex_unlock(&bandwidth->lock);
+}
+
+/**
+ * Chooses the transcoding profile for the next track of a connection.
+ *
+ * The profile drops straight to one the measured throughput sustains, and one further step
+ * if the buffer nearly ran dry during the previous track. It only climbs one step per track,
+ * and only when the throughput leaves `bitrate_headroom` to spare.
+ *
+ * @param conn The connection the track is streamed from.
+ * @return The index of the profile in `conn->profiles`.
+ */
+int choose_profile(const Connection *const conn)
+{
+    BandwidthEstimator *const bandwidth = conn->bandwidth;
+
+    pthread_mutex_lock(&bandwidth->lock);
+    const int previous = MIN(MAX(bandwidth->profile, 0), conn->number_profiles - 1);
+    int profile = previous;
+
+    if (bandwidth->samples > 0) {
+        const double throughput = bandwidth->throughput;
+
+        while (profile > 0
+               && profile_bitrate(&conn->profiles[profile]) > throughput) {
+            profile--;
+        }
+        if (bandwidth->min_buffer >= 0
+            && bandwidth->min_buffer < min_buffer_seconds) {
+            profile = MAX(profile - 1, 0);
+        } else if (profile == previous
+                   && profile + 1 < conn->number_profiles
+                   && profile_bitrate(&conn->profiles[profile + 1]) *
+                   bitrate_headroom <= throughput) {
+            profile++;
+        }
+    }
+    bandwidth->profile = profile;
+    bandwidth->min_buffer = -1;
+    pthread_mutex_unlock(&bandwidth->lock);
+
+    return profile;
+}
+
+/**
+ * Returns how many seconds of audio a stream holds ahead of the playback position.
+ * Must be called with the stream lock held.
+ *
+ * @param stream The stream to inspect.
+ * @return The buffered seconds of audio.
+ */
+static double buffered_seconds(const Stream *const stream)
+{
+    return stream->downloaded / stream->bytes_per_second - stream->played;
+}
+
+/**
+ * Releases one reference to a stream, freeing it once no thread uses it anymore.
+ *
+ * @param stream The stream to release.
+ */
+static void release_stream(Stream *const stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    const int references = --stream->references;
+
+    pthread_mutex_unlock(&stream->lock);
+
+    if (references == 0) {
+        close(stream->fd);
+        pthread_cond_destroy(&stream->cond);
+        pthread_mutex_destroy(&stream->lock);
+        free(stream->url);
+        free(stream->command);
+        free(stream);
+    }
+}
+
+/**
+ * Callback used by libcurl to append downloaded audio to the spool file of a stream.
+ *
+ * Downloading pauses while more than `max_buffer_seconds` of audio are buffered, so skipped
+ * tracks do not waste bandwidth. Throughput is sampled over the time spent actually receiving
+ * data and fed into the bandwidth estimator of the connection.
+ *
+ * @param ptr    A pointer to the received data.
+ * @param size   The size of each data element.
+ * @param nmemb  The number of elements received.
+ * @param arg    The Stream being downloaded.
+ * @return The number of bytes consumed, or 0 to abort the transfer.
+ */
+static size_t write_stream_data(void *const ptr, const size_t size,
+                                const size_t nmemb, void *const arg)
+{
+    Stream *const stream = (Stream *) arg;
+    const size_t bytes = size * nmemb;
+    const double wait_start = monotonic_seconds();
+
+    pthread_mutex_lock(&stream->lock);
+    if (stream->downloaded == 0 && stream->duration > 0) {
+        curl_off_t length = -1;
+
+        curl_easy_getinfo(stream->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                          &length);
+        if (length > 0) {
+            stream->bytes_per_second = (double) length / stream->duration;
+        }
+    }
+    while (!stream->cancelled
+           && buffered_seconds(stream) > max_buffer_seconds) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&stream->cond, &stream->lock, &deadline);
+    }
+    const int cancelled = stream->cancelled;
+    const off_t offset = stream->downloaded;
+
+    pthread_mutex_unlock(&stream->lock);
+
+    const double now = monotonic_seconds();
+
+    stream->window_idle += now - wait_start;
+    if (cancelled || pwrite(stream->fd, ptr, bytes, offset) != (ssize_t) bytes) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    stream->downloaded += bytes;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
+    // Sample throughput over windows of a couple of seconds of active transfer
+    stream->window_bytes += bytes;
+    const double active = now - stream->window_start - stream->window_idle;
+
+    if (active >= THROUGHPUT_WINDOW) {
+        record_throughput(stream->bandwidth,
+                          stream->window_bytes * 8 / 1000.0 / active);
+        stream->window_start = now;
+        stream->window_idle = 0;
+        stream->window_bytes = 0;
+    }
+    return bytes;
+}
+
+/**
+ * Function that runs in a separate thread to download a song into the spool file of its stream.
+ *
+ * @param arg Pointer to the Stream to download.
+ */
+void *download_thread(void *arg)
+{
+    Stream *const stream = (Stream *) arg;
+
+    stream->curl = curl_easy_init();
+    if (stream->curl != NULL) {
+        stream->window_start = monotonic_seconds();
+        curl_easy_setopt(stream->curl, CURLOPT_URL, stream->url);
+        curl_easy_setopt(stream->curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(stream->curl, CURLOPT_WRITEFUNCTION, write_stream_data);
+        curl_easy_setopt(stream->curl, CURLOPT_WRITEDATA, stream);
+
+        if (curl_easy_perform(stream->curl) == CURLE_OK) {
+            // Short transfers on a fast link still count, unless too small to time reliably
+            const double active = monotonic_seconds() - stream->window_start -
+                stream->window_idle;
+
+            if (stream->window_bytes >= THROUGHPUT_MIN_BYTES && active > 0) {
+                record_throughput(stream->bandwidth,
+                                  stream->window_bytes * 8 / 1000.0 / active);
+            }
+        }
+        curl_easy_cleanup(stream->curl);
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    stream->complete = 1;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
+    release_stream(stream);
+    return NULL;
+}
+
+/**
+ * Function that runs in a separate thread to feed the spooled song to the playback program.
+ * Waits for the download whenever playback catches up with it.
+ *
+ * @param arg Pointer to the Stream to play.
+ */
+void *feeder_thread(void *arg)
+{
+    Stream *const stream = (Stream *) arg;
+    FILE *const fp = popen(stream->command, "w");
 
     if (fp == NULL) {
         fprintf(stderr, "Failed to open stream.\n");
-        free(url);
+        release_stream(stream);
         return NULL;
     }
-    // Clean up allocated memory and close the file pointer.
-    pclose(fp);
-    free(url);
 
+    char buffer[16384];
+    off_t fed = 0;
+
+    while (1) {
+        pthread_mutex_lock(&stream->lock);
+        while (!stream->cancelled && !stream->complete
+               && fed == stream->downloaded) {
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+        const off_t available = stream->downloaded - fed;
+        const int done = stream->cancelled || available == 0;
+
+        pthread_mutex_unlock(&stream->lock);
+
+        if (done) {
+            break;
+        }
+
+        const ssize_t bytes_read = pread(stream->fd, buffer,
+                                         MIN(available, (off_t) sizeof(buffer)),
+                                         fed);
+
+        if (bytes_read <= 0
+            || fwrite(buffer, 1, bytes_read, fp) != (size_t) bytes_read) {
+            break;
+        }
+        fed += bytes_read;
+    }
+
+    pclose(fp);
+    release_stream(stream);
     return NULL;
 }
 
+/**
+ * Starts streaming a song: one thread downloads it and another feeds it to the playback program.
+ *
+ * @param url       The stream URL, owned by the stream afterwards.
+ * @param command   The playback command reading from stdin, owned by the stream afterwards.
+ * @param duration  The song duration in seconds.
+ * @param offset    The seconds of the song skipped by the server.
+ * @param bitrate   The requested bitrate in kbps, 0 for the original file.
+ * @param bandwidth The estimator of the connection the song is streamed from.
+ * @return The new stream, with one reference held by the caller, or NULL on failure.
+ */
+Stream *open_stream(char *const url, char *const command, const int duration,
+                    const int offset, const int bitrate,
+                    BandwidthEstimator *const bandwidth)
+{
+    Stream *const stream = calloc(1, sizeof(Stream));
+    FILE *const spool = tmpfile();
+
+    if (stream == NULL || spool == NULL) {
+        fprintf(stderr, "Error: Failed to set up the stream.\n");
+        free(stream);
+        free(url);
+        free(command);
+        if (spool != NULL) {
+            fclose(spool);
+        }
+        return NULL;
+    }
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    stream->url = url;
+    stream->command = command;
+    stream->fd = dup(fileno(spool));
+    stream->references = 3;
+    stream->duration = duration - offset;
+    stream->offset = offset;
+    stream->bitrate = bitrate;
+    stream->bytes_per_second = (bitrate > 0 ? bitrate : original_bitrate) * 1000 / 8.0;
+    stream->bandwidth = bandwidth;
+    fclose(spool);
+
+    pthread_t download_id;
+    pthread_t feeder_id;
+
+    pthread_create(&download_id, NULL, &download_thread, (void *) stream);
+    pthread_detach(download_id);
+    pthread_create(&feeder_id, NULL, &feeder_thread, (void *) stream);
+    pthread_detach(feeder_id);
+
+    return stream;
+}
+
+/**
+ * Cancels the stream of the song currently playing, if any, and drops the UI reference to it.
+ */
+void cancel_stream(void)
+{
+    Stream *const stream = current_stream;
+
+    if (stream == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    stream->cancelled = 1;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
+    current_stream = NULL;
+    release_stream(stream);
+}
+
+/**
+ * Updates the playback position of the current stream and records its buffer health,
+ * which drives the choice of profile for the next track.
+ *
+ * @param play_time Seconds of the current song played so far.
+ */
+void observe_stream(const int play_time)
+{
+    Stream *const stream = current_stream;
+
+    if (stream == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    stream->played = play_time - stream->offset;
+    pthread_cond_broadcast(&stream->cond);
+    const int complete = stream->complete;
+    const double buffered = buffered_seconds(stream);
+
+    pthread_mutex_unlock(&stream->lock);
+
+    // The buffer is empty when playback starts, so give it a moment to fill
+    if (complete || play_time - stream->offset < min_buffer_seconds) {
+        return;
+    }
+
+    BandwidthEstimator *const bandwidth = stream->bandwidth;
+
+    pthread_mutex_lock(&bandwidth->lock);
+    if (bandwidth->min_buffer < 0 || buffered < bandwidth->min_buffer) {
+        bandwidth->min_buffer = buffered;
+    }
+    pthread_mutex_unlock(&bandwidth->lock);
+}
+
 /**
  * Function to set up ncurses for the program's user interface.
  * Initializes the ncurses library and sets various options, as well as defining color pairs.
@@ -463,11 +1197,12 @@ void print_playlist_data(const AppState *const app_state,
                     WINDOW *const *const windows)
 {
     WINDOW *const window = windows[0];
-    const Playlist *const playlist = app_state->playlist;
+    const Playlist *const playlist = viewed_playlist(app_state);
     const int max_row = getmaxy(window) - 2;
     const int max_col = getmaxx(window) - 2;
     const int current_index = playlist->selected_song_idx;
-    const int current_playing = playlist->current_playing;
+    const int current_playing =
+        playlist == app_state->playlist ? playlist->current_playing : -1;
     const int number_items = playlist->size;
 
     // Define the row decoration, based on whether the current panel is active or not
@@ -477,28 +1212,41 @@ void print_playlist_data(const AppState *const app_state,
          number_items - max_row * 2 / 3) ? current_index -
         max_row / 3 : number_items - max_row;
     const int last_item = MIN(first_item + max_row, number_items);
+    int first_marked;
+    int last_marked;
 
+    selection_range(app_state, &first_marked, &last_marked);
     wclear(window);
     box(window, 0, 0);
 
-    // Loop through each item to display, formatting the text as necessary and applying row decoration
-    for (int i = first_item; i < last_item; i++) {
-        char *text = format_text(playlist->songs[i]->name, max_col,
+    // Name the playlist on the border, marking named playlists with unsaved changes
+    if (app_state->viewed_playlist >= 0) {
+        const NamedPlaylist *const named =
+            &app_state->playlists[app_state->viewed_playlist];
+
+        mvwprintw(window, 0, 2, " %s%s ", named->name,
+                  (named->id == NULL || named->synced_version != playlist->version) ?
+                  " [+]" : "");
+    } else if (app_state->number_playlists > 0) {
+        mvwprintw(window, 0, 2, " Queue ");
+    }
+
+    // Loop through each item to display, walking the playlist in order from the first visible song
+    int node = song_node(playlist, first_item);
+
+    for (int i = first_item; i < last_item; i++, node = next_node(playlist, node)) {
+        char *text = format_text(playlist->nodes[node].song->name, max_col,
                                  (i ==
                                   current_playing) ?
                                  appearance[ind_playing] : "");
-        // Decorate the row, based on whether the current row is selected or not
-        wattron(window,
-                (i ==
-                 current_index) ? COLOR_PAIR(ACTIVE +
-                                             1) : COLOR_PAIR(INACTIVE +
-                                                             1) | A_REVERSE);
+        // Decorate the row, based on whether the current row is selected, marked or neither
+        const int decoration = (i == current_index) ? COLOR_PAIR(ACTIVE + 1) :
+            (i >= first_marked && i <= last_marked) ? COLOR_PAIR(INACTIVE + 1) :
+            COLOR_PAIR(INACTIVE + 1) | A_REVERSE;
+
+        wattron(window, decoration);
         mvwprintw(window, i + 1 - first_item, 1, "%s", text);
-        wattroff(window,
-                 (i ==
-                  current_index) ? COLOR_PAIR(ACTIVE +
-                                              1) : COLOR_PAIR(INACTIVE +
-                                                              1) | A_REVERSE);
+        wattroff(window, decoration);
         free(text);
     }
     wrefresh(window);
@@ -571,9 +1319,16 @@ void print_window_data(const AppState *const app_state, const PanelType panel,
         // Active panel                           Inactive panel        
         { COLOR_PAIR(ACTIVE + 1), COLOR_PAIR(INACTIVE + 1) },   // Selected row
         { COLOR_PAIR(INACTIVE + 1) | A_REVERSE, COLOR_PAIR(INACTIVE + 1) | A_REVERSE }, // Not selected row
+        { COLOR_PAIR(INACTIVE + 1), COLOR_PAIR(INACTIVE + 1) | A_REVERSE }, // Row in visual selection
     };
 
     const int is_active_panel = app_state->current_panel == panel ? 0 : 1;
+    int first_marked = -1;
+    int last_marked = -1;
+
+    if (is_active_panel == 0) {
+        selection_range(app_state, &first_marked, &last_marked);
+    }
 
     // Loop through each item to display, formatting the text as necessary and applying row decoration
     for (int i = first_item; i < last_item; i++) {
@@ -590,7 +1345,8 @@ void print_window_data(const AppState *const app_state, const PanelType panel,
         }
         text = format_text(text, max_col, "");
         wstandend(window);
-        const int is_selected_item = (i == current_index) ? 0 : 1;
+        const int is_selected_item = (i == current_index) ? 0 :
+            (i >= first_marked && i <= last_marked) ? 2 : 1;
 
         wattron(window, row_decoration[is_selected_item][is_active_panel]);
         mvwprintw(window, i + 1 - first_item, 1, "%s", text);
@@ -634,6 +1390,90 @@ int get_action(const int keypress)
     return -1;
 }
 
+/**
+ * Returns a pointer to the selected index of the panel that currently has the focus.
+ *
+ * @param app_state Pointer to the AppState struct
+ * @return The selected index of the playlist, or of the focused panel of the music browser
+ */
+static int *focused_index(AppState *const app_state)
+{
+    if (app_state->current_view == VIEW_PLAYLIST) {
+        return &viewed_playlist(app_state)->selected_song_idx;
+    }
+
+    switch (app_state->current_panel) {
+        case PANEL_ARTISTS:
+            return &app_state->selected_artist_idx;
+        case PANEL_ALBUMS:
+            return &app_state->selected_album_idx;
+        default:
+            return &app_state->selected_song_idx;
+    }
+}
+
+/**
+ * Returns the rows covered by the visual selection of the focused panel, or the
+ * highlighted row alone when no selection is active.
+ *
+ * @param app_state Pointer to the AppState struct
+ * @param first     Receives the first row of the selection
+ * @param last      Receives the last row of the selection (inclusive)
+ */
+void selection_range(const AppState *const app_state, int *const first,
+                     int *const last)
+{
+    const int current = *focused_index((AppState *) app_state);
+    const int anchor = app_state->selection_anchor;
+
+    if (anchor < 0) {
+        *first = *last = current;
+        return;
+    }
+    *first = MIN(anchor, current);
+    *last = MAX(anchor, current);
+}
+
+/**
+ * Starts a visual selection anchored at the highlighted row, or cancels the active one.
+ *
+ * @param app_state Pointer to the AppState struct
+ */
+void toggle_selection(AppState *const app_state)
+{
+    const int current = *focused_index(app_state);
+
+    app_state->selection_anchor =
+        (app_state->selection_anchor < 0 && current >= 0) ? current : -1;
+}
+
+/**
+ * Moves the selected songs of the playlist one position up or down, keeping them selected.
+ *
+ * @param app_state Pointer to the AppState struct
+ * @param action    Either `move_up` or `move_down`
+ */
+void move_selection(AppState *const app_state, const int action)
+{
+    Playlist *const playlist = viewed_playlist(app_state);
+    int first;
+    int last;
+
+    selection_range(app_state, &first, &last);
+
+    const int offset = action == move_up ? -1 : 1;
+
+    if (first < 0 || first + offset < 0 || last + offset >= playlist->size) {
+        return;
+    }
+
+    move_songs(playlist, first, last - first + 1, first + offset);
+    playlist->selected_song_idx += offset;
+    if (app_state->selection_anchor >= 0) {
+        app_state->selection_anchor += offset;
+    }
+}
+
 /**
  * Updates the selected indexes of the panels based on the given movement and current state of the app.
  * If the current view is VIEW_PLAYLIST, only updates the selected song index.
@@ -653,10 +1493,11 @@ void movement(const int action, AppState *const app_state,
     }
 
     if (app_state->current_view == VIEW_PLAYLIST) {
+        Playlist *const playlist = viewed_playlist(app_state);
 
         // Declare an array of pointers to integer variables that hold the selected index of each panel.
         int *const panel_destinations[1] = {
-            &app_state->playlist->selected_song_idx,
+            &playlist->selected_song_idx,
         };
 
         const int current_panel = 0;
@@ -666,7 +1507,7 @@ void movement(const int action, AppState *const app_state,
         // and MOVE_BOTTOM movements.
         const int panel_offset[][2] = {
             //MOVE_TOP      MOVE_BOTTOM
-            { 0, app_state->playlist->size - 1 },       // Playlist
+            { 0, playlist->size - 1 },  // Playlist
         };
 
         // If the movement is valid, set the panel destination to the corresponding
@@ -676,14 +1517,14 @@ void movement(const int action, AppState *const app_state,
                 panel_offset[current_panel][special_movement];
         }
         // Check if it is possible to go up
-        else if (action == up && app_state->playlist->selected_song_idx > 0) {
-            --app_state->playlist->selected_song_idx;
+        else if (action == up && playlist->selected_song_idx > 0) {
+            --playlist->selected_song_idx;
         }
         // Check if it is possible to go down
         else if (action == down
-                 && app_state->playlist->selected_song_idx <
+                 && playlist->selected_song_idx <
                  panel_offset[current_panel][1]) {
-            ++app_state->playlist->selected_song_idx;
+            ++playlist->selected_song_idx;
         }
         return;
     }
@@ -736,11 +1577,13 @@ void movement(const int action, AppState *const app_state,
             case left:
                 if (app_state->current_panel > 0) {
                     --app_state->current_panel;
+                    app_state->selection_anchor = -1;
                 }
                 break;
             case right:
                 if (app_state->current_panel < NUM_PANELS - 1) {
                     ++app_state->current_panel;
+                    app_state->selection_anchor = -1;
                 }
                 break;
             default:
@@ -750,11 +1593,11 @@ void movement(const int action, AppState *const app_state,
     Artist *const artist =
         &(app_state->db->artists[app_state->selected_artist_idx]);
     app_state->artist = artist;
-    get_albums(app_state->connection, app_state->db, artist->id);
+    get_albums(app_state->db, artist->id);
     Album *const album = &(artist->albums[app_state->selected_album_idx]);
 
     app_state->album = album;
-    get_songs(app_state->connection, app_state->db, artist->id, album->id);
+    get_songs(app_state->db, artist->id, album->id);
     return;
 }
 
@@ -799,1146 +1642,5538 @@ Database init_db(void)
 }
 
 /**
- * Initializes a new playlist by allocating memory for 10 songs and setting
- * all other fields to their default values.
+ * Returns a pseudo-random number from the generator of a shuffle order.
  *
- * @return A new playlist struct.
+ * @param shuffle The shuffle order owning the generator.
+ * @param bound   The exclusive upper bound of the result.
+ * @return A number in [0, bound).
  */
-Playlist init_playlist(void)
+static int shuffle_random(ShuffleOrder *const shuffle, const int bound)
 {
-    // Allocate memory for 10 Song pointers using malloc.
-    Song **const songs = (Song **) malloc(10 * sizeof(Song *));
+    unsigned int state = shuffle->seed;
 
-    // If malloc fails to allocate memory, clean up and exit program.
-    if (songs == NULL) {
-        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
-        exit(EXIT_FAILURE);
-    }
-    // Initialize and return a new Playlist struct with dynamically allocated memory for songs.
-    return (Playlist) {
-        .songs = &songs[0],
-        .size = 0,
-        .capacity = 10,
-        .current_playing = 0,
-        .start_time = (time_t) NULL,
-        .play_time = 0,
-        .status = STOPPED,
-        .repeat_shuffle = 0,
-        .selected_song_idx = -1,
-        .pid = -1,
-        .shuffle_repeat_status = NONE,
-    };
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    shuffle->seed = state;
+    return (int) (state % (unsigned int) bound);
 }
 
 /**
- * Adds a song to the end of the playlist. If the playlist is full, its capacity is doubled.
+ * Tells whether a node is waiting in the upcoming part of the shuffle order.
+ * The position array is never cleared, so an entry only counts if the slot it points to
+ * points back at the node.
  *
- * @param song     A pointer to the Song struct to be added.
- * @param playlist A pointer to the Playlist struct where the song will be added.
+ * @param shuffle The shuffle order.
+ * @param node    The node to look for.
+ * @return 1 if the node has not been played in the current cycle, 0 otherwise.
  */
-void add_song(const Song *const song, Playlist *const playlist)
+static inline int shuffle_contains(const ShuffleOrder *const shuffle,
+                                   const int node)
 {
-    // If the playlist is full, double its capacity by reallocating its memory block.
-    if (playlist->size == playlist->capacity) {
-        // Double the playlist's capacity using bit shifting for faster multiplication.
-        playlist->capacity <<= 1;
+    const int position = shuffle->position[node];
 
-        // Reallocate the memory block with the new capacity.
-        void *const p = realloc(playlist->songs,
-                          playlist->capacity * sizeof(playlist->songs));
+    return position >= 0 && position < shuffle->number_upcoming
+        && shuffle->upcoming[position] == node;
+}
 
-        // If realloc fails, print an error message and exit the program.
-        if (p == NULL) {
-            fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
-            exit(EXIT_FAILURE);
-        }
-        // Update the playlist's memory block and song array pointers
-        playlist->songs = p;
+/**
+ * Adds a node at a uniformly random place of the upcoming shuffle order in O(1),
+ * as one step of an inside-out Fisher-Yates shuffle.
+ *
+ * @param shuffle The shuffle order.
+ * @param node    The node to add.
+ */
+static void shuffle_insert(ShuffleOrder *const shuffle, const int node)
+{
+    const int last = shuffle->number_upcoming++;
+    const int target = shuffle_random(shuffle, last + 1);
 
-    }
-    // Add the song to the end of the playlist and update its size
-    playlist->songs[playlist->size++] = (Song *) song;
+    if (target != last) {
+        const int displaced = shuffle->upcoming[target];
 
-    // If the selected song index was not previously set, set it to the first song in the playlist.
-    if (playlist->selected_song_idx == -1) {
-        playlist->selected_song_idx = 0;
+        shuffle->upcoming[last] = displaced;
+        shuffle->position[displaced] = last;
     }
+    shuffle->upcoming[target] = node;
+    shuffle->position[node] = target;
 }
 
 /**
- * Update the selected index based on the query and action.
+ * Takes a node out of the upcoming shuffle order in O(1), filling its slot with the last one.
  *
- * @param possible_matches The possible matches to search through.
- * @param n_matches The number of possible matches.
- * @param query The query to search for.
- * @param action The action to perform.
- * @param current_found The current found index.
+ * @param shuffle The shuffle order.
+ * @param node    The node to remove; nothing happens if it is not upcoming.
+ */
+static void shuffle_remove(ShuffleOrder *const shuffle, const int node)
+{
+    if (!shuffle_contains(shuffle, node)) {
+        return;
+    }
+
+    const int position = shuffle->position[node];
+    const int last = shuffle->upcoming[--shuffle->number_upcoming];
+
+    shuffle->upcoming[position] = last;
+    shuffle->position[last] = position;
+    shuffle->position[node] = -1;
+}
+
+/**
+ * Pushes a node onto the shuffle history, dropping the oldest half when it is full.
+ *
+ * @param playlist The playlist owning the shuffle order.
+ * @param node     The node that was played.
+ */
+static void shuffle_push_history(Playlist *const playlist, const int node)
+{
+    ShuffleOrder *const shuffle = &playlist->shuffle;
+
+    if (node == 0) {
+        return;
+    }
+    if (shuffle->number_history == SHUFFLE_HISTORY_LENGTH) {
+        shuffle->number_history /= 2;
+        memmove(shuffle->history,
+                shuffle->history + SHUFFLE_HISTORY_LENGTH - shuffle->number_history,
+                shuffle->number_history * sizeof(shuffle->history[0]));
+    }
+    shuffle->history[shuffle->number_history].node = node;
+    shuffle->history[shuffle->number_history].generation =
+        playlist->nodes[node].generation;
+    shuffle->number_history++;
+}
+
+/**
+ * Picks the next song in shuffle mode. The song playing goes to the history, and once
+ * every song has been played a new random cycle starts.
+ *
+ * @param playlist The playlist to shuffle.
+ * @return The position of the next song, or -1 if the playlist is empty.
+ */
+int shuffle_next(Playlist *const playlist)
+{
+    ShuffleOrder *const shuffle = &playlist->shuffle;
+
+    if (playlist->size == 0) {
+        return -1;
+    }
+
+    shuffle_push_history(playlist, playlist->playing_node);
+    if (shuffle->number_upcoming == 0) {
+        for (int node = song_node(playlist, 0); node != 0;
+             node = next_node(playlist, node)) {
+            if (node != playlist->playing_node || playlist->size == 1) {
+                shuffle_insert(shuffle, node);
+            }
+        }
+    }
+
+    const int node = shuffle->upcoming[shuffle->number_upcoming - 1];
+
+    shuffle_remove(shuffle, node);
+    return song_position(playlist, node);
+}
+
+/**
+ * Steps back through the shuffle history. The song playing is put back at the front of
+ * the upcoming order so that `next` returns to it.
+ *
+ * @param playlist The playlist being shuffled.
+ * @return The position of the previous song, or -1 if the history is empty.
+ */
+int shuffle_previous(Playlist *const playlist)
+{
+    ShuffleOrder *const shuffle = &playlist->shuffle;
+
+    while (shuffle->number_history > 0) {
+        const ShuffleHistoryEntry entry =
+            shuffle->history[--shuffle->number_history];
+
+        // Skip songs removed from the playlist since they were played
+        if (playlist->nodes[entry.node].generation != entry.generation
+            || playlist->nodes[entry.node].song == NULL) {
+            continue;
+        }
+
+        const int current = playlist->playing_node;
+
+        if (current != 0 && !shuffle_contains(shuffle, current)) {
+            const int last = shuffle->number_upcoming++;
+
+            shuffle->upcoming[last] = current;
+            shuffle->position[current] = last;
+        }
+        return song_position(playlist, entry.node);
+    }
+    return -1;
+}
+
+/**
+ * Lists the positions of the songs that will play next, in order, following the
+ * shuffle order in shuffle mode and the playlist order otherwise.
+ * Prefetching and caching use it to stay ahead of playback.
+ *
+ * @param playlist  The playlist.
+ * @param positions Receives up to `max` positions.
+ * @param max       The maximum number of positions to return.
+ * @return The number of positions written.
+ */
+int upcoming_songs(const Playlist *const playlist, int *const positions,
+                   const int max)
+{
+    int count = 0;
+
+    if (playlist->shuffle_repeat_status == SHUFFLE) {
+        const ShuffleOrder *const shuffle = &playlist->shuffle;
+
+        for (int i = shuffle->number_upcoming - 1; i >= 0 && count < max; i--) {
+            positions[count++] = song_position(playlist, shuffle->upcoming[i]);
+        }
+        return count;
+    }
+
+    if (playlist->shuffle_repeat_status == REPEAT) {
+        while (count < max && playlist->current_playing < playlist->size) {
+            positions[count++] = playlist->current_playing;
+        }
+        return count;
+    }
+
+    for (int i = playlist->current_playing + 1;
+         i < playlist->size && count < max; i++) {
+        positions[count++] = i;
+    }
+    return count;
+}
+
+/**
+ * Initializes a new, empty playlist. Its node pool starts with room for 16 songs
+ * and grows on demand.
+ *
+ * @return A new playlist struct.
+ */
+Playlist init_playlist(void)
+{
+    PlaylistNode *const nodes = calloc(16, sizeof(PlaylistNode));
+    int *const upcoming = malloc(16 * sizeof(int));
+    int *const position = malloc(16 * sizeof(int));
+    ShuffleHistoryEntry *const history =
+        malloc(SHUFFLE_HISTORY_LENGTH * sizeof(ShuffleHistoryEntry));
+
+    // If any allocation fails, clean up and exit program.
+    if (nodes == NULL || upcoming == NULL || position == NULL || history == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+        exit(EXIT_FAILURE);
+    }
+    // Node 0 is the empty tree, so its size must stay 0.
+    return (Playlist) {
+        .nodes = nodes,
+        .root = 0,
+        .free_node = 0,
+        .used = 1,
+        .capacity = 16,
+        .playing_node = 0,
+        .shuffle = {
+            .upcoming = upcoming,
+            .number_upcoming = 0,
+            .position = position,
+            .history = history,
+            .number_history = 0,
+            .seed = ((unsigned int) time(NULL) ^ ((unsigned int) getpid() << 16)) | 1,
+        },
+        .size = 0,
+        .version = 0,
+        .current_playing = 0,
+        .start_time = (time_t) NULL,
+        .journal = NULL,
+        .play_time = 0,
+        .resume_position = -1,
+        .status = STOPPED,
+        .repeat_shuffle = 0,
+        .selected_song_idx = -1,
+        .pid = -1,
+        .shuffle_repeat_status = NONE,
+    };
+}
+
+/**
+ * Returns a pseudo-random priority for a playlist node.
+ *
+ * @return A 32-bit xorshift pseudo-random number.
+ */
+static unsigned int node_priority(void)
+{
+    static unsigned int state = 2463534242u;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/**
+ * Makes sure the node pool of a playlist can hand out `count` more nodes without reallocating.
+ *
+ * @param playlist The playlist whose pool should grow.
+ * @param count    The number of nodes about to be allocated.
+ */
+void reserve_songs(Playlist *const playlist, const int count)
+{
+    if (playlist->used + count <= playlist->capacity) {
+        return;
+    }
+
+    int capacity = playlist->capacity;
+
+    while (capacity < playlist->used + count) {
+        capacity <<= 1;
+    }
+
+    PlaylistNode *const p =
+        realloc(playlist->nodes, capacity * sizeof(PlaylistNode));
+    int *const upcoming =
+        realloc(playlist->shuffle.upcoming, capacity * sizeof(int));
+    int *const position =
+        realloc(playlist->shuffle.position, capacity * sizeof(int));
+
+    if (p == NULL || upcoming == NULL || position == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+        exit(EXIT_FAILURE);
+    }
+    playlist->nodes = p;
+    playlist->shuffle.upcoming = upcoming;
+    playlist->shuffle.position = position;
+    playlist->capacity = capacity;
+}
+
+/**
+ * Takes a node from the free list of a playlist, or from its pool if the list is empty.
+ *
+ * @param playlist The playlist to allocate from.
+ * @param song     The song the node refers to.
+ * @return The index of the new node.
+ */
+static int new_node(Playlist *const playlist, Song *const song)
+{
+    int node = playlist->free_node;
+    unsigned int generation = 0;
+
+    if (node != 0) {
+        playlist->free_node = playlist->nodes[node].right;
+        generation = playlist->nodes[node].generation;
+    } else {
+        reserve_songs(playlist, 1);
+        node = playlist->used++;
+    }
+
+    playlist->nodes[node] = (PlaylistNode) {
+        .song = song,
+        .left = 0,
+        .right = 0,
+        .parent = 0,
+        .size = 1,
+        .priority = node_priority(),
+        .generation = generation,
+    };
+    shuffle_insert(&playlist->shuffle, node);
+    return node;
+}
+
+/**
+ * Returns every node of a subtree to the free list of its playlist.
+ *
+ * @param playlist The playlist owning the nodes.
+ * @param node     The root of the subtree to release.
+ */
+static void free_nodes(Playlist *const playlist, const int node)
+{
+    if (node == 0) {
+        return;
+    }
+
+    PlaylistNode *const nodes = playlist->nodes;
+
+    free_nodes(playlist, nodes[node].left);
+    free_nodes(playlist, nodes[node].right);
+    if (node == playlist->playing_node) {
+        playlist->playing_node = 0;
+    }
+    shuffle_remove(&playlist->shuffle, node);
+    nodes[node].song = NULL;
+    nodes[node].generation++;
+    nodes[node].right = playlist->free_node;
+    playlist->free_node = node;
+}
+
+/**
+ * Recomputes the size of a node from its children and links them back to it.
+ *
+ * @param nodes The node pool.
+ * @param node  The node to update.
+ */
+static inline void update_node(PlaylistNode *const nodes, const int node)
+{
+    const int left = nodes[node].left;
+    const int right = nodes[node].right;
+
+    nodes[node].size = 1 + nodes[left].size + nodes[right].size;
+    nodes[left].parent = node;
+    nodes[right].parent = node;
+}
+
+/**
+ * Splits a subtree into its first `count` songs and the rest.
+ *
+ * @param nodes The node pool.
+ * @param node  The root of the subtree to split.
+ * @param count The number of songs that go to the left part.
+ * @param left  Receives the root of the first `count` songs.
+ * @param right Receives the root of the remaining songs.
+ */
+static void split_nodes(PlaylistNode *const nodes, const int node,
+                        const int count, int *const left, int *const right)
+{
+    if (node == 0) {
+        *left = *right = 0;
+        return;
+    }
+
+    const int left_size = nodes[nodes[node].left].size;
+
+    if (count <= left_size) {
+        split_nodes(nodes, nodes[node].left, count, left, &nodes[node].left);
+        *right = node;
+    } else {
+        split_nodes(nodes, nodes[node].right, count - left_size - 1,
+                    &nodes[node].right, right);
+        *left = node;
+    }
+    update_node(nodes, node);
+}
+
+/**
+ * Concatenates two subtrees, keeping the tree balanced through the node priorities.
+ *
+ * @param nodes The node pool.
+ * @param left  The root of the songs that go first.
+ * @param right The root of the songs that go last.
+ * @return The root of the merged subtree.
+ */
+static int merge_nodes(PlaylistNode *const nodes, const int left,
+                       const int right)
+{
+    if (left == 0 || right == 0) {
+        return left ? left : right;
+    }
+
+    if (nodes[left].priority > nodes[right].priority) {
+        nodes[left].right = merge_nodes(nodes, nodes[left].right, right);
+        update_node(nodes, left);
+        return left;
+    }
+    nodes[right].left = merge_nodes(nodes, left, nodes[right].left);
+    update_node(nodes, right);
+    return right;
+}
+
+/**
+ * Sets the root of a playlist tree and refreshes the derived fields of the playlist.
+ *
+ * @param playlist The playlist to update.
+ * @param root     The new root.
+ */
+static void set_root(Playlist *const playlist, const int root)
+{
+    playlist->root = root;
+    playlist->version++;
+    playlist->nodes[root].parent = 0;
+    playlist->nodes[0] = (PlaylistNode) { 0 };
+    playlist->size = playlist->nodes[root].size;
+    if (playlist->playing_node != 0) {
+        playlist->current_playing = song_position(playlist, playlist->playing_node);
+    }
+}
+
+/**
+ * Returns the node holding the song at a given position of the playlist.
+ *
+ * @param playlist The playlist to search.
+ * @param index    The position of the song.
+ * @return The node at the position, or 0 if the position is out of range.
+ */
+int song_node(const Playlist *const playlist, int index)
+{
+    const PlaylistNode *const nodes = playlist->nodes;
+    int node = playlist->root;
+
+    if (index < 0 || index >= playlist->size) {
+        return 0;
+    }
+
+    while (node != 0) {
+        const int left_size = nodes[nodes[node].left].size;
+
+        if (index < left_size) {
+            node = nodes[node].left;
+        } else if (index == left_size) {
+            return node;
+        } else {
+            index -= left_size + 1;
+            node = nodes[node].right;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns the position of a node in the playlist.
+ *
+ * @param playlist The playlist owning the node.
+ * @param node     The node to locate.
+ * @return The position of the node in the playlist.
+ */
+int song_position(const Playlist *const playlist, int node)
+{
+    const PlaylistNode *const nodes = playlist->nodes;
+    int position = nodes[nodes[node].left].size;
+
+    while (node != playlist->root) {
+        const int parent = nodes[node].parent;
+
+        if (nodes[parent].right == node) {
+            position += nodes[nodes[parent].left].size + 1;
+        }
+        node = parent;
+    }
+    return position;
+}
+
+/**
+ * Returns the node following another one in playlist order, for in-order traversal.
+ *
+ * @param playlist The playlist owning the node.
+ * @param node     The current node.
+ * @return The next node, or 0 after the last one.
+ */
+int next_node(const Playlist *const playlist, int node)
+{
+    const PlaylistNode *const nodes = playlist->nodes;
+
+    if (nodes[node].right != 0) {
+        node = nodes[node].right;
+        while (nodes[node].left != 0) {
+            node = nodes[node].left;
+        }
+        return node;
+    }
+    while (node != playlist->root && nodes[nodes[node].parent].right == node) {
+        node = nodes[node].parent;
+    }
+    return node == playlist->root ? 0 : nodes[node].parent;
+}
+
+/**
+ * Returns the song at a given position of the playlist.
+ *
+ * @param playlist The playlist to search.
+ * @param index    The position of the song.
+ * @return The song, or NULL if the position is out of range.
+ */
+Song *playlist_song(const Playlist *const playlist, const int index)
+{
+    return playlist->nodes[song_node(playlist, index)].song;
+}
+
+/**
+ * Inserts a contiguous run of songs into the playlist.
+ *
+ * The run is first built into a balanced subtree in linear time and then spliced in
+ * with one split and two merges, so the position costs O(log n) regardless of the run length.
+ *
+ * @param playlist The playlist to insert into.
+ * @param index    The position where the first song goes, clamped to the playlist size.
+ * @param songs    The songs to insert.
+ * @param count    The number of songs.
+ */
+void insert_songs(Playlist *const playlist, const int index,
+                  Song *const *const songs, const int count)
+{
+    if (count <= 0) {
+        return;
+    }
+    reserve_songs(playlist, count);
+
+    // Build a treap from the sorted run with a stack holding its right spine
+    PlaylistNode *const nodes = playlist->nodes;
+    int *const spine = malloc(count * sizeof(int));
+    int top = 0;
+
+    if (spine == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; i++) {
+        const int node = new_node(playlist, songs[i]);
+        int last = 0;
+
+        while (top > 0 && nodes[spine[top - 1]].priority < nodes[node].priority) {
+            last = spine[--top];
+            update_node(nodes, last);
+        }
+        nodes[node].left = last;
+        if (top > 0) {
+            nodes[spine[top - 1]].right = node;
+        }
+        spine[top++] = node;
+    }
+    while (top > 1) {
+        update_node(nodes, spine[--top]);
+    }
+    update_node(nodes, spine[0]);
+
+    int left;
+    int right;
+    const int position = MIN(MAX(index, 0), playlist->size);
+
+    split_nodes(nodes, playlist->root, position, &left, &right);
+    set_root(playlist, merge_nodes(nodes, merge_nodes(nodes, left, spine[0]),
+                                   right));
+    free(spine);
+    log_record(playlist, songs, count, "A %d %d\n", position, count);
+
+    // If the selected song index was not previously set, set it to the first song in the playlist.
+    if (playlist->selected_song_idx == -1) {
+        playlist->selected_song_idx = 0;
+    }
+}
+
+/**
+ * Adds a song to the end of the playlist.
+ *
+ * @param song     A pointer to the Song struct to be added.
+ * @param playlist A pointer to the Playlist struct where the song will be added.
+ */
+void add_song(const Song *const song, Playlist *const playlist)
+{
+    Song *const songs[1] = { (Song *) song };
+
+    insert_songs(playlist, playlist->size, songs, 1);
+}
+
+/**
+ * Removes a contiguous range of songs from the playlist in O(log n + count).
+ *
+ * @param playlist The playlist to remove from.
+ * @param index    The position of the first song to remove.
+ * @param count    The number of songs to remove.
+ */
+void remove_songs(Playlist *const playlist, const int index, const int count)
+{
+    const int first = MAX(index, 0);
+    const int last = MIN(index + count, playlist->size);
+
+    if (first >= last) {
+        return;
+    }
+
+    PlaylistNode *const nodes = playlist->nodes;
+    int left;
+    int middle;
+    int right;
+
+    split_nodes(nodes, playlist->root, first, &left, &right);
+    split_nodes(nodes, right, last - first, &middle, &right);
+    free_nodes(playlist, middle);
+    set_root(playlist, merge_nodes(nodes, left, right));
+    log_record(playlist, NULL, 0, "D %d %d\n", first, last - first);
+}
+
+/**
+ * Moves a contiguous range of songs to another position of the playlist in O(log n).
+ *
+ * @param playlist The playlist to reorder.
+ * @param index    The position of the first song to move.
+ * @param count    The number of songs to move.
+ * @param target   The position of the first moved song once the range is placed,
+ *                 clamped so the range stays inside the playlist.
+ */
+void move_songs(Playlist *const playlist, const int index, const int count,
+                const int target)
+{
+    const int first = MAX(index, 0);
+    const int last = MIN(index + count, playlist->size);
+
+    if (first >= last) {
+        return;
+    }
+
+    PlaylistNode *const nodes = playlist->nodes;
+    int left;
+    int middle;
+    int right;
+
+    split_nodes(nodes, playlist->root, first, &left, &right);
+    split_nodes(nodes, right, last - first, &middle, &right);
+    const int rest = merge_nodes(nodes, left, right);
+    const int destination = MIN(MAX(target, 0), nodes[rest].size);
+
+    split_nodes(nodes, rest, destination, &left, &right);
+    set_root(playlist, merge_nodes(nodes, merge_nodes(nodes, left, middle),
+                                   right));
+    log_record(playlist, NULL, 0, "M %d %d %d\n", first, last - first,
+               destination);
+}
+
+/**
+ * Removes every song from the playlist in O(1) by resetting its node pool.
+ *
+ * @param playlist The playlist to clear.
+ */
+void clear_songs(Playlist *const playlist)
+{
+    playlist->root = 0;
+    playlist->free_node = 0;
+    playlist->used = 1;
+    playlist->size = 0;
+    playlist->playing_node = 0;
+    playlist->current_playing = 0;
+    playlist->selected_song_idx = -1;
+    playlist->shuffle.number_upcoming = 0;
+    playlist->shuffle.number_history = 0;
+    playlist->version++;
+    log_record(playlist, NULL, 0, "C\n");
+}
+
+/**
+ * Appends text formatted with a va_list to a growing buffer.
+ *
+ * @param buffer The buffer to append to; its data may be NULL when empty.
+ * @param format The printf-style format.
+ * @param args   The arguments of the format.
+ */
+static void append_vformat(struct url_data *const buffer,
+                           const char *const format, va_list args)
+{
+    va_list copy;
+
+    va_copy(copy, args);
+    const int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+
+    char *const p = realloc(buffer->data, buffer->size + length + 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+    buffer->data = p;
+    vsnprintf(buffer->data + buffer->size, length + 1, format, args);
+    buffer->size += length;
+}
+
+/**
+ * Appends formatted text to a growing buffer.
+ *
+ * @param buffer The buffer to append to; its data may be NULL when empty.
+ * @param format The printf-style format, followed by its arguments.
+ */
+void append_format(struct url_data *const buffer, const char *const format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    append_vformat(buffer, format, args);
+    va_end(args);
+}
+
+/**
+ * Appends a song record to a journal buffer: its duration, ID, title, artist, album and
+ * server separated by tabs, so the queue can be restored without asking the server.
+ *
+ * @param buffer The buffer to append to.
+ * @param song   The song to record.
+ */
+static void append_song(struct url_data *const buffer, const Song *const song)
+{
+    const char *const fields[5] = {
+        song->id, song->name, song->artist, song->album, song->origin->name,
+    };
+
+    append_format(buffer, "S\t%d", song->duration);
+    for (int i = 0; i < 5; i++) {
+        const int start = buffer->size + 1;
+
+        append_format(buffer, "\t%s", fields[i] ? fields[i] : "");
+
+        // Tabs and line breaks separate the fields and the records
+        for (char *c = buffer->data + start; *c; c++) {
+            if (*c == '\t' || *c == '\n' || *c == '\r') {
+                *c = ' ';
+            }
+        }
+    }
+    append_format(buffer, "\n");
+}
+
+/**
+ * Parses a song record written by append_song().
+ *
+ * @param line The record, including its line break; it is modified while parsing.
+ * @return The interned song, or NULL if the record is malformed.
+ */
+static Song *parse_song_record(char *const line)
+{
+    char *fields[7];
+    char *c = line;
+    int count = 0;
+    char separator = '\t';
+
+    // Records written before servers were recorded have no server field
+    while (separator == '\t' && count < 7) {
+        fields[count++] = c;
+        c += strcspn(c, "\t\n");
+        separator = *c;
+        if (separator == '\0') {
+            return NULL;
+        }
+        *c++ = '\0';
+    }
+    if (separator != '\n' || count < 6 || strcmp(fields[0], "S") != 0
+        || fields[2][0] == '\0') {
+        return NULL;
+    }
+
+    const Song song = {
+        .id = fields[2],
+        .name = fields[3],
+        .artist = fields[4],
+        .album = fields[5],
+        .duration = atoi(fields[1]),
+        .origin = find_connection(count == 7 ? fields[6] : ""),
+    };
+
+    return intern_song_data(&song);
+}
+
+/**
+ * Returns the playback position worth restoring, in seconds into the current song.
+ *
+ * @param playlist The queue.
+ * @return The position, 0 if nothing is playing.
+ */
+static int playback_position(const Playlist *const playlist)
+{
+    if (playlist->status == STOPPED) {
+        return MAX(playlist->resume_position, 0);
+    }
+    return MAX(playlist->play_time, 0);
+}
+
+/**
+ * Hands the whole queue over to the journal thread, to replace the file and every
+ * record not written yet.
+ *
+ * @param playlist The queue, with a journal.
+ */
+void compact_journal(Playlist *const playlist)
+{
+    Journal *const journal = playlist->journal;
+    struct url_data snapshot = { 0, NULL };
+
+    append_format(&snapshot, "C\n");
+    if (playlist->size > 0) {
+        append_format(&snapshot, "A 0 %d\n", playlist->size);
+    }
+    for (int node = song_node(playlist, 0); node != 0;
+         node = next_node(playlist, node)) {
+        append_song(&snapshot, playlist->nodes[node].song);
+    }
+    if (playlist->size > 0) {
+        append_format(&snapshot, "P %d %d\n", playlist->current_playing,
+                      playback_position(playlist));
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    free(journal->pending.data);
+    free(journal->snapshot.data);
+    journal->pending = (struct url_data) { 0, NULL };
+    journal->snapshot = snapshot;
+    journal->records = 0;
+    pthread_cond_signal(&journal->cond);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+/**
+ * Logs a change of the queue to its journal, if it has one. The record is written in
+ * the background, so this costs as much as formatting it.
+ *
+ * @param playlist     The queue, after the change.
+ * @param songs        Songs recorded after the record line, or NULL.
+ * @param number_songs The number of songs.
+ * @param format       The printf-style format of the record line, followed by its arguments.
+ */
+void log_record(Playlist *const playlist, Song *const *const songs,
+                const int number_songs, const char *const format, ...)
+{
+    Journal *const journal = playlist->journal;
+
+    if (journal == NULL) {
+        return;
+    }
+
+    // Rewrite the file once the log outgrows the queue, so replaying it stays proportional
+    // to the queue; the snapshot already holds this change
+    if (journal->records >= MAX(journal_compact_records, 2 * playlist->size)) {
+        compact_journal(playlist);
+        return;
+    }
+
+    va_list args;
+
+    pthread_mutex_lock(&journal->lock);
+    va_start(args, format);
+    append_vformat(&journal->pending, format, args);
+    va_end(args);
+    for (int i = 0; i < number_songs; i++) {
+        append_song(&journal->pending, songs[i]);
+    }
+    journal->records++;
+    pthread_cond_signal(&journal->cond);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+/**
+ * Logs the current song and playback position of the queue.
+ *
+ * @param playlist The queue.
+ */
+void log_position(Playlist *const playlist)
+{
+    if (playlist->journal == NULL || playlist->size == 0) {
+        return;
+    }
+
+    const int position = playback_position(playlist);
+
+    log_record(playlist, NULL, 0, "P %d %d\n", playlist->current_playing,
+               position);
+    playlist->journal->logged_position = position;
+}
+
+/**
+ * Writes a whole buffer to a file descriptor.
+ *
+ * @param fd     The file descriptor.
+ * @param buffer The data to write.
+ * @return 0 on success, -1 on failure.
+ */
+static int write_buffer(const int fd, const struct url_data *const buffer)
+{
+    const char *data = buffer->data;
+    int left = buffer->size;
+
+    while (left > 0) {
+        const ssize_t written = write(fd, data, left);
+
+        if (written < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (written > 0) {
+            data += written;
+            left -= written;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Atomically replaces the journal file with a snapshot followed by the records logged
+ * after it, then reopens it for appending.
+ *
+ * @param journal  The journal.
+ * @param snapshot The compacted queue.
+ * @param pending  The records logged after the snapshot.
+ * @return 0 on success, -1 if the file was left untouched.
+ */
+static int replace_journal(Journal *const journal,
+                           const struct url_data *const snapshot,
+                           const struct url_data *const pending)
+{
+    struct url_data temporary = { 0, NULL };
+
+    append_format(&temporary, "%s.tmp", journal->path);
+
+    const int fd = open(temporary.data, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    const int written = fd >= 0 && write_buffer(fd, snapshot) == 0
+        && write_buffer(fd, pending) == 0 && fsync(fd) == 0;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!written || rename(temporary.data, journal->path) != 0) {
+        unlink(temporary.data);
+        free(temporary.data);
+        return -1;
+    }
+
+    // Make the rename itself durable, through the directory holding the file
+    char *const slash = strrchr(temporary.data, '/');
+
+    if (slash != NULL) {
+        *slash = '\0';
+
+        const int directory = open(temporary.data, O_RDONLY | O_DIRECTORY);
+
+        if (directory >= 0) {
+            fsync(directory);
+            close(directory);
+        }
+    }
+    free(temporary.data);
+
+    close(journal->fd);
+    journal->fd = open(journal->path, O_WRONLY | O_APPEND);
+    return 0;
+}
+
+/**
+ * Thread that writes the journal: records logged close together are batched into one
+ * write and one fsync, and snapshots replace the file.
+ *
+ * @param arg The journal.
+ * @return NULL.
+ */
+static void *journal_thread(void *const arg)
+{
+    Journal *const journal = arg;
+
+    pthread_mutex_lock(&journal->lock);
+    while (1) {
+        while (!journal->stopping && journal->pending.size == 0
+               && journal->snapshot.size == 0) {
+            pthread_cond_wait(&journal->cond, &journal->lock);
+        }
+
+        // Give a burst of changes a moment to arrive before paying for the fsync
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long) (JOURNAL_BATCH_DELAY * 1e9);
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while (!journal->stopping
+               && pthread_cond_timedwait(&journal->cond, &journal->lock,
+                                         &deadline) != ETIMEDOUT) {
+        }
+
+        struct url_data snapshot = journal->snapshot;
+        struct url_data pending = journal->pending;
+        const int stopping = journal->stopping;
+
+        journal->snapshot = (struct url_data) { 0, NULL };
+        journal->pending = (struct url_data) { 0, NULL };
+        pthread_mutex_unlock(&journal->lock);
+
+        // A snapshot starts by clearing the queue, so appending it is a valid fallback
+        if (snapshot.size == 0 || replace_journal(journal, &snapshot, &pending) != 0) {
+            if (write_buffer(journal->fd, &snapshot) == 0
+                && write_buffer(journal->fd, &pending) == 0) {
+                fdatasync(journal->fd);
+            }
+        }
+        free(snapshot.data);
+        free(pending.data);
+
+        pthread_mutex_lock(&journal->lock);
+        if (stopping && journal->pending.size == 0 && journal->snapshot.size == 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return NULL;
+}
+
+/**
+ * Returns the path of a file kept between sessions, creating the directories leading to it.
+ *
+ * @param name The file name; relative names are resolved in $XDG_STATE_HOME/sksonic,
+ *             or ~/.local/state/sksonic if it is not set.
+ * @return The path, which must be freed by the caller, or NULL if there is no home directory.
+ */
+char *state_path(const char *const name)
+{
+    const char *const state_home = getenv("XDG_STATE_HOME");
+    const char *const home = getenv("HOME");
+    struct url_data path = { 0, NULL };
+
+    if (name[0] == '/') {
+        append_format(&path, "%s", name);
+    } else if (state_home != NULL && state_home[0] == '/') {
+        append_format(&path, "%s/sksonic/%s", state_home, name);
+    } else if (home != NULL && home[0] == '/') {
+        append_format(&path, "%s/.local/state/sksonic/%s", home, name);
+    } else {
+        return NULL;
+    }
+
+    for (char *c = strchr(path.data + 1, '/'); c != NULL; c = strchr(c + 1, '/')) {
+        *c = '\0';
+        mkdir(path.data, 0700);
+        *c = '/';
+    }
+    return path.data;
+}
+
+/**
+ * Applies the records of a journal file to the queue. Replay stops at the first
+ * malformed record, such as one torn by a crash.
+ *
+ * @param playlist The queue, without a journal attached.
+ * @param path     The journal file.
+ */
+void replay_journal(Playlist *const playlist, const char *const path)
+{
+    FILE *const file = fopen(path, "r");
+
+    if (file == NULL) {
+        return;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &capacity, file)) > 0
+           && line[length - 1] == '\n') {
+        int index;
+        int count;
+        int target;
+
+        if (strcmp(line, "C\n") == 0) {
+            clear_songs(playlist);
+        } else if (sscanf(line, "A %d %d", &index, &count) == 2) {
+            Song **const songs = malloc(MAX(count, 1) * sizeof(Song *));
+            int number_songs = 0;
+
+            while (songs != NULL && number_songs < count
+                   && getline(&line, &capacity, file) > 0
+                   && (songs[number_songs] = parse_song_record(line)) != NULL) {
+                number_songs++;
+            }
+            if (number_songs == count) {
+                insert_songs(playlist, index, songs, count);
+            }
+            free(songs);
+            if (number_songs < count) {
+                break;
+            }
+        } else if (sscanf(line, "D %d %d", &index, &count) == 2) {
+            remove_songs(playlist, index, count);
+        } else if (sscanf(line, "M %d %d %d", &index, &count, &target) == 3) {
+            move_songs(playlist, index, count, target);
+        } else if (sscanf(line, "P %d %d", &index, &target) == 2) {
+            if (index >= 0 && index < playlist->size) {
+                playlist->current_playing = index;
+                playlist->playing_node = song_node(playlist, index);
+                playlist->resume_position = MAX(target, 0);
+            }
+        } else {
+            break;
+        }
+    }
+
+    // Nothing to resume if the song was removed after its position was logged
+    if (playlist->playing_node == 0) {
+        playlist->resume_position = -1;
+    }
+    free(line);
+    fclose(file);
+}
+
+/**
+ * Restores the queue from its journal and starts logging its changes.
+ *
+ * @param playlist The queue, still empty.
+ * @param name     The journal file name, resolved by state_path().
+ */
+void open_journal(Playlist *const playlist, const char *const name)
+{
+    char *const path = state_path(name);
+
+    if (path == NULL) {
+        return;
+    }
+    replay_journal(playlist, path);
+
+    Journal *const journal = calloc(1, sizeof(Journal));
+
+    if (journal == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the journal.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (journal->fd < 0) {
+        fprintf(stderr, "Error: Failed to open the queue journal %s.\n", path);
+        free(journal);
+        free(path);
+        return;
+    }
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->cond, NULL);
+    journal->path = path;
+    journal->logged_position = playback_position(playlist);
+    playlist->journal = journal;
+    pthread_create(&journal->thread, NULL, &journal_thread, (void *) journal);
+
+    // Start from a compacted file, which also drops anything torn by a crash
+    compact_journal(playlist);
+}
+
+/**
+ * Writes the records still pending and detaches the journal from the queue.
+ *
+ * @param playlist The queue.
+ */
+void close_journal(Playlist *const playlist)
+{
+    Journal *const journal = playlist->journal;
+
+    if (journal == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    journal->stopping = 1;
+    pthread_cond_signal(&journal->cond);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->thread, NULL);
+
+    close(journal->fd);
+    pthread_mutex_destroy(&journal->lock);
+    pthread_cond_destroy(&journal->cond);
+    free(journal->path);
+    free(journal);
+    playlist->journal = NULL;
+}
+
+/**
+ * Update the selected index based on the query and action.
+ *
+ * @param possible_matches The possible matches to search through.
+ * @param n_matches The number of possible matches.
+ * @param query The query to search for.
+ * @param action The action to perform.
+ * @param current_found The current found index.
  * @param idx_to_update The index to update.
  */
-void update_selected_index(const char *const possible_matches[], const int n_matches, const char *const query, const int action, int *current_found, int *idx_to_update)
+void update_selected_index(const char *const possible_matches[], const int n_matches, const char *const query, const int action, int *current_found, int *idx_to_update)
+{
+    if (query == NULL) {
+        return;
+    }
+
+    int start, end, step;
+    
+    switch (action) {
+        case search_previous:
+            start = *current_found - 1;
+            end = 0;
+            step = -1;
+            break;
+        case search_next:
+            start = *current_found + 1;
+            end = n_matches;
+            step = 1;
+            break;
+        default:
+            start = 0;
+            end = n_matches;
+            step = 1;
+            break;
+    }
+
+    for (int i = start; i != end; i += step) {
+        if (strstr(possible_matches[i], query) != NULL) {
+            *idx_to_update = i;
+            *current_found = i;
+            return; // Found a match, exit the loop
+        }
+    }
+}
+
+/**
+ * Search for a query in the current view and update the selected index.
+ *
+ * @param app_state The application state.
+ */
+void search_idx(AppState *app_state)
+{
+    WINDOW *playback_window = *app_state->windows[WINDOW_PLAYBACK];
+    ViewType current_view = app_state->current_view;
+    PanelType current_panel = app_state->current_panel;
+
+
+    const int n_matches = current_view == WINDOW_PLAYLIST ? viewed_playlist(app_state)->size : 
+                          current_panel == PANEL_ARTISTS ? app_state->db->number_artists :
+                          current_panel == PANEL_ALBUMS ? app_state->artist->number_albums :
+                          current_panel == PANEL_SONGS ? app_state->album->number_songs : 0;
+    if (n_matches == 0) {
+        return;
+    }
+
+    const char *possible_matches[n_matches];
+
+    int *idx_to_update = NULL;
+    if (current_view == WINDOW_PLAYLIST) {
+        Playlist *const playlist = viewed_playlist(app_state);
+        int node = song_node(playlist, 0);
+
+        for (int i = 0; i < n_matches; i++, node = next_node(playlist, node)) {
+            possible_matches[i] = playlist->nodes[node].song->name;
+        }
+        idx_to_update = &playlist->selected_song_idx;
+    } else {
+        if (current_panel == PANEL_ARTISTS) {
+            for (int i = 0; i < n_matches; i++) {
+                possible_matches[i] = app_state->db->artists[i].name;
+            }
+            idx_to_update = &app_state->selected_artist_idx;
+        }
+        if (current_panel == PANEL_ALBUMS) {
+            for (int i = 0; i < n_matches; i++) {
+                possible_matches[i] = app_state->artist->albums[i].name;
+            }
+            idx_to_update = &app_state->selected_album_idx;
+        }
+        if (current_panel == PANEL_SONGS) {
+            for (int i = 0; i < n_matches; i++) {
+                possible_matches[i] = app_state->album->songs[i].name;
+            }
+            idx_to_update = &app_state->selected_song_idx;
+        }
+    }
+
+    wclear(playback_window);
+    wprintw(playback_window, "Search: ");
+    wrefresh(playback_window);
+
+    char query[MAX_QUERY_LENGTH] = { 0 };
+    int c;
+    int i = 0;
+    int current_found = 0;
+
+    while ((c = getch()) != '\n') {
+        switch (c) {
+            case -1:
+                break;
+            case 27:
+                return;
+                break;
+            case '\n':
+                query[i] = '\0';
+                break;
+            case 127:
+            case KEY_BACKSPACE:
+            case KEY_DC:
+                if (i > 0) {
+                    query[--i] = '\0';
+                    mvwaddch(playback_window, 0, strlen("Search: ") + i, ' ');
+                }
+                break;
+            default:
+                if (i < MAX_QUERY_LENGTH - 1) {
+                    mvwaddch(playback_window, 0, strlen("Search: ") + i, c);
+                    query[i++] = c;
+                }
+                break;
+        }
+        
+        // Print any new characters entered
+        wrefresh(playback_window);
+
+        // Update the artist and album based on the query
+        update_selected_index(possible_matches, n_matches, query, 0, &current_found, idx_to_update);
+        Artist *const artist =
+            &(app_state->db->artists[app_state->selected_artist_idx]);
+        app_state->artist = artist;
+        get_albums(app_state->db, artist->id);
+        Album *const album = &(artist->albums[app_state->selected_album_idx]);
+
+        app_state->album = album;
+        get_songs(app_state->db, artist->id, album->id);
+    
+        // Refresh
+        if (current_view == VIEW_PLAYLIST) {
+            print_playlist_data(app_state,app_state->windows[WINDOW_PLAYLIST]);
+        } else {
+            // Refresh all panels (we could also refresh the child panel)
+            for (int i = 0; i < NUM_PANELS; i++) {   
+                print_window_data(app_state, i, app_state->windows[WINDOW_INFO]);
+            }
+        }
+    }
+    int action = -1;
+    while (1) {
+        c = getch();
+        action = get_action(c);
+        switch (action) {
+            case add_and_play:
+                if (app_state->current_view == VIEW_INFO) {
+                    const int first_song_to_play =
+                        add_to_playlist(app_state, app_state->playlist);
+                    play_song(app_state, first_song_to_play);
+                }
+                if (app_state->current_view == VIEW_PLAYLIST) {
+                    play_viewed_playlist(app_state);
+                    refresh_windows(app_state, app_state->windows[WINDOW_PLAYLIST], 1);
+                }
+                return;
+                break;
+            case add:
+                add_to_playlist(app_state, viewed_playlist(app_state));
+                return;
+                break;
+            case search_next:
+            case search_previous:
+                update_selected_index(possible_matches, n_matches, query, action, &current_found, idx_to_update);
+                
+                // Update the artist and album as we request next or previous
+                Artist *const artist =
+                    &(app_state->db->artists[app_state->selected_artist_idx]);
+                app_state->artist = artist;
+                get_albums(app_state->db, artist->id);
+                Album *const album = &(artist->albums[app_state->selected_album_idx]);
+
+                app_state->album = album;
+                get_songs(app_state->db, artist->id, album->id);
+
+                // Refresh
+                if (current_view == VIEW_PLAYLIST) {
+                    print_playlist_data(app_state,app_state->windows[WINDOW_PLAYLIST]);
+                } else {
+                    // Refresh all panels (we could also refresh the child panel)
+                    for (int i = 0; i < NUM_PANELS; i++) {   
+                        print_window_data(app_state, i, app_state->windows[WINDOW_INFO]);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (action != search_next && action != search_previous && c != -1) {
+            break;
+        }
+    }
+}
+
+/**
+ * Deletes a range of songs from the playlist, stopping playback if it includes the song
+ * being played, and keeps the selection inside the playlist.
+ *
+ * @param app_state A pointer to the AppState struct containing the current program state.
+ * @param index     The position of the first song to delete.
+ * @param count     The number of songs to delete.
+ */
+void delete_songs(const AppState *const app_state, const int index,
+                  const int count)
+{
+    Playlist *const playlist = viewed_playlist(app_state);
+
+    // If the range is out of the playlist, return without deleting any song.
+    if (index >= playlist->size || index < 0 || count <= 0) {
+        return;
+    }
+    // Stop playback when deleting the song that is currently being played
+    if (playlist == app_state->playlist
+        && playlist->current_playing >= index
+        && playlist->current_playing < index + count
+        && playlist->status != STOPPED) {
+        stop_playback(app_state);
+    }
+
+    remove_songs(playlist, index, count);
+
+    // If there are no more songs in the playlist, set the selected song index to -1.
+    if (playlist->size == 0) {
+        playlist->selected_song_idx = -1;
+    }
+    // If the deleted songs were the last ones in the playlist, select the new last song.
+    else if (playlist->selected_song_idx >= playlist->size) {
+        playlist->selected_song_idx = playlist->size - 1;
+    }
+}
+
+/**
+ * Deletes the currently selected song from the playlist.
+ *
+ * @param app_state A pointer to the AppState struct containing the current program state.
+ */
+void delete_song(const AppState *const app_state)
+{
+    delete_songs(app_state, viewed_playlist(app_state)->selected_song_idx, 1);
+}
+
+/**
+ * Removes every song from the playlist, stopping playback first.
+ *
+ * @param app_state A pointer to the AppState struct containing the current program state.
+ */
+void clear_playlist(const AppState *const app_state)
+{
+    Playlist *const playlist = viewed_playlist(app_state);
+
+    if (playlist == app_state->playlist) {
+        stop_playback(app_state);
+    }
+    clear_songs(playlist);
+}
+
+/**
+ * Removes every song from the playlist except the one playing, or the selected one when
+ * playback is stopped.
+ *
+ * @param app_state A pointer to the AppState struct containing the current program state.
+ */
+void crop_playlist(const AppState *const app_state)
+{
+    Playlist *const playlist = viewed_playlist(app_state);
+    const int keep = playlist->status != STOPPED ?
+        playlist->current_playing : playlist->selected_song_idx;
+
+    if (keep < 0 || keep >= playlist->size) {
+        return;
+    }
+
+    remove_songs(playlist, keep + 1, playlist->size - keep - 1);
+    remove_songs(playlist, 0, keep);
+    playlist->selected_song_idx = 0;
+}
+
+/**
+ * Gets the process ID (PID) of the running instance of the specified program.
+ *
+ * This function executes the "pidof" command to obtain the PID of the specified executable. It assumes that the
+ * "pidof" command is available on the system and does not perform any error checking or validation.
+ *
+ * @param program A Playback_Program struct containing the name of the program executable to look up.
+ * @return The PID of the running instance of the program, or -1 if no such instance is found.
+ */
+pid_t get_pid(const Playback_Program program)
+{
+    char command[100];
+
+    // Add cut because pthreads spawns a `sh` command which, in turn, starts program.executable
+    snprintf(command, sizeof(command), "pidof %s | cut -d \" \" -f 2",
+             program.executable);
+
+    FILE *const fp = popen(command, "r");
+
+    if (fp == NULL) {
+        perror("Error executing command");
+        return (pid_t) - 1;
+    }
+    // Read the output of the pidof command into a fixed-size buffer.
+    char pid_str[16];
+
+    if (fgets(pid_str, sizeof(pid_str), fp) == NULL) {
+        pclose(fp);
+        return (pid_t) - 1;
+    }
+    // Convert the PID string to an integer
+    pclose(fp);
+    return (pid_t) atoi(pid_str);
+}
+
+/**
+ * Changes the playback status of a running process by sending it a signal.
+ *
+ * This function sends the specified signal to the process with the given PID, using the kill() system call.
+ *
+ * @param pid The process ID of the running process.
+ * @param signal The signal to send to the process.
+ */
+void change_playback_status(const pid_t pid, const int signal)
+{
+
+    // If the PID is invalid or not set, there's nothing to do.
+    if (pid <= 0) {
+        return;
+    }
+
+    if (kill(pid, signal) == -1) {
+        // If the kill() call fails, log an error message.
+        perror("Error sending signal to process");
+    }
+}
+
+/**
+ * Writes a state to the state_dump file through a temporary file and a rename,
+ * so readers see either the previous state or the new one, never a partial write.
+ *
+ * @param state The state to write.
+ * @return 0 on success, -1 on failure.
+ */
+static int write_state(const struct url_data *const state)
+{
+    struct url_data temporary = { 0, NULL };
+
+    append_format(&temporary, "%s.tmp", state_dump);
+
+    const int fd = open(temporary.data, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    const int written = fd >= 0 && write_buffer(fd, state) == 0;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    const int status = written && rename(temporary.data, state_dump) == 0 ? 0 : -1;
+
+    if (status != 0) {
+        unlink(temporary.data);
+    }
+    free(temporary.data);
+    return status;
+}
+
+/**
+ * Thread that writes the states published by dump(). Only the latest state is kept,
+ * so a burst of changes during a slow write costs a single extra write.
+ *
+ * @param arg Unused.
+ * @return NULL.
+ */
+static void *publisher_thread(void *const arg)
+{
+    StatePublisher *const publisher = &state_publisher;
+
+    pthread_mutex_lock(&publisher->lock);
+    while (1) {
+        while (!publisher->stopping && publisher->pending.data == NULL) {
+            pthread_cond_wait(&publisher->cond, &publisher->lock);
+        }
+        if (publisher->pending.data == NULL) {
+            break;
+        }
+
+        struct url_data state = publisher->pending;
+
+        publisher->pending = (struct url_data) { 0, NULL };
+        pthread_mutex_unlock(&publisher->lock);
+
+        // On failure the file keeps the previous state until the next change
+        write_state(&state);
+        free(state.data);
+
+        pthread_mutex_lock(&publisher->lock);
+    }
+    pthread_mutex_unlock(&publisher->lock);
+    return NULL;
+}
+
+/**
+ * Writes the last published state, if any, and stops the publisher thread.
+ */
+void stop_publisher(void)
+{
+    StatePublisher *const publisher = &state_publisher;
+
+    pthread_mutex_lock(&publisher->lock);
+    publisher->stopping = 1;
+    pthread_cond_signal(&publisher->cond);
+    pthread_mutex_unlock(&publisher->lock);
+
+    if (publisher->started) {
+        pthread_join(publisher->thread, NULL);
+        publisher->started = 0;
+    }
+}
+
+/**
+ * Builds a JSON object describing the playback state: the status and, unless stopped,
+ * the current song, its artist and album, and the playback position.
+ *
+ * @param app_state Pointer to the AppState object.
+ * @return The object, which must be freed with cJSON_Delete.
+ */
+cJSON *state_object(const AppState *const app_state)
+{
+    const Playlist *const playlist = app_state->playlist;
+    const Song *const song = playlist_song(playlist, playlist->current_playing);
+    cJSON *const object = cJSON_CreateObject();
+
+    if (playlist->status == STOPPED || song == NULL) {
+        cJSON_AddStringToObject(object, "status", "stopped");
+        return object;
+    }
+
+    cJSON_AddStringToObject(object, "status",
+                            playlist->status == PLAYING ? "playing" : "paused");
+    cJSON_AddStringToObject(object, "artist", song->artist);
+    cJSON_AddStringToObject(object, "album", song->album);
+    cJSON_AddStringToObject(object, "song", song->name);
+    cJSON_AddStringToObject(object, "id", song->id);
+    if (number_connections > 1) {
+        cJSON_AddStringToObject(object, "server", song->origin->name);
+    }
+    cJSON_AddNumberToObject(object, "length", song->duration);
+    cJSON_AddNumberToObject(object, "playtime", playlist->play_time);
+    cJSON_AddNumberToObject(object, "time", (double) time(NULL));
+    return object;
+}
+
+/**
+ * Publishes the current state of the application after a change: dumps it to the
+ * state_dump file and pushes it to the subscribers of the control socket.
+ *
+ * The state is formatted here and handed over to background threads, so a slow
+ * filesystem or client cannot stall the UI.
+ *
+ * @param app_state Pointer to the AppState object containing the current state
+ *                  of the application.
+ */
+void dump(const AppState *const app_state)
+{
+    mpris_changed(app_state);
+    if (state_dump == NULL && !control_server.started) {
+        return;
+    }
+
+    cJSON *const object = state_object(app_state);
+
+    if (state_dump != NULL) {
+        struct url_data state = { 0, NULL };
+
+        // The file holds an empty line while stopped
+        if (app_state->playlist->status != STOPPED) {
+            char *const json = cJSON_PrintUnformatted(object);
+
+            append_format(&state, "%s\n", json);
+            free(json);
+        } else {
+            append_format(&state, "\n");
+        }
+
+        StatePublisher *const publisher = &state_publisher;
+
+        pthread_mutex_lock(&publisher->lock);
+        if (!publisher->started && !publisher->stopping) {
+            publisher->started =
+                pthread_create(&publisher->thread, NULL, &publisher_thread, NULL) == 0;
+        }
+        // Replace a state that was not written yet, nobody needs to see it anymore
+        free(publisher->pending.data);
+        publisher->pending = state;
+        pthread_cond_signal(&publisher->cond);
+        pthread_mutex_unlock(&publisher->lock);
+    }
+
+    if (control_server.started) {
+        cJSON_AddStringToObject(object, "event", "state");
+        control_send(-1, object);
+    }
+    cJSON_Delete(object);
+}
+
+/**
+ * Notifies the user about the currently playing song.
+ *
+ * The notification is handed over to a background thread, which shows it through the
+ * desktop notification service, so starting a song never waits for it.
+ *
+ * @param app_state A pointer to an AppState struct containing information about the application's state.
+ */
+void notify(const AppState *const app_state)
+{
+    const Playlist *const playlist = app_state->playlist;
+    const Song *const song = playlist_song(playlist, playlist->current_playing);
+    Notifier *const notifier = &desktop_notifier;
+    struct url_data text = { 0, NULL };
+
+    append_format(&text, "%s - %s - %s", song->artist, song->album, song->name);
+
+    char *const summary = strdup("Now playing");
+
+    if (summary == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the notification.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&notifier->lock);
+    if (!notifier->started && !notifier->stopping) {
+        notifier->started =
+            pthread_create(&notifier->thread, NULL, &notifier_thread, NULL) == 0;
+    }
+    // Replace a notification that was not shown yet, its song is already over
+    free(notifier->summary);
+    free(notifier->text);
+    notifier->summary = summary;
+    notifier->text = text.data;
+    pthread_cond_signal(&notifier->cond);
+    pthread_mutex_unlock(&notifier->lock);
+}
+
+/**
+ * Plays a song from the current playlist.
+ * If defined, sends a notification and/or dumps the AppState into a file
+ *
+ * This function stops any currently-playing songs and starts playing the specified song. It generates a URL to stream the song,
+ * executes the specified player program with appropriate flags, and updates the playlist state accordingly.
+ *
+ * @param app_state A pointer to the current application state.
+ * @param index The index of the song in the playlist to play.
+ */
+void play_song(const AppState *const app_state, const int index)
+{
+    // Get references to the relevant data structures.
+    Playlist *const playlist = app_state->playlist;
+    const Playback_Program program = app_state->program;
+
+    // Validate the song index.
+    if (index >= playlist->size) {
+        fprintf(stderr, "Invalid song index.\n");
+        return;
+    }
+    // Send SIGTERM to the playlist process to stop any other playing processes.
+    change_playback_status(playlist->pid, SIGTERM);
+
+    // Set up playlist state for the new song.
+    const Song *const song = playlist_song(playlist, index);
+
+    // A song restored from the journal resumes where it was left.
+    const int offset = index == playlist->current_playing ?
+        MIN(MAX(playlist->resume_position, 0), MAX(song->duration - 1, 0)) : 0;
+
+    playlist->start_time = time(NULL);
+    playlist->current_playing = index;
+    playlist->playing_node = song_node(playlist, index);
+    shuffle_remove(&playlist->shuffle, playlist->playing_node);
+    playlist->status = PLAYING;
+    playlist->play_time = offset;
+    playlist->resume_position = -1;
+    log_position(playlist);
+
+    // Drop the stream of the previous song and pick the profile for this one.
+    cancel_stream();
+
+    // Stream from the closest server holding the song
+    const Source source = song_source(song);
+    const Connection *const conn = source.connection;
+    const TranscodeProfile *const profile =
+        &conn->profiles[choose_profile(conn)];
+
+    // Generate URL to stream the song.
+    char *const url = generate_stream_url(conn, source.id, profile, offset);
+
+    if (url == NULL) {
+        return;
+    }
+
+    // Construct the command string to run the playback program, reading the song from stdin.
+    const size_t command_len =
+        snprintf(NULL, 0, "%s %s pipe:0 > /dev/null 2>&1",
+                 program.executable, program.flags) + 1;
+    char *const command = malloc(command_len);
+
+    if (command == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the command.\n");
+        free(url);
+        return;
+    }
+
+    snprintf(command, command_len, "%s %s pipe:0 > /dev/null 2>&1",
+             program.executable, program.flags);
+
+    // Download and feed the song to the playback program from separate threads.
+    current_stream = open_stream(url, command, song->duration, offset,
+                                 profile->max_bitrate, conn->bandwidth);
+
+    // Store the new process ID in the playlist state.
+    playlist->pid = get_pid(program);
+    if (desktop_notifications || notify_cmd != NULL) {
+        notify(app_state);
+    }
+    dump(app_state);
+}
+
+/**
+ * Stops any currently-playing song in the playlist.
+ *
+ * This function sends a SIGTERM signal to the process ID associated with the current playlist, if one exists, and updates the
+ * playlist state to indicate that playback has stopped.
+ *
+ * @param app_state A pointer to the current application state.
+ */
+void stop_playback(const AppState *const app_state)
+{
+    // Get a reference to the current playlist.
+    Playlist *const playlist = app_state->playlist;
+
+    // Check if there is a current song playing.
+    if (playlist->status != STOPPED) {
+        // Stop the playback process and update playlist state.
+        change_playback_status(app_state->playlist->pid, SIGTERM);
+        cancel_stream();
+        app_state->playlist->status = STOPPED;
+        app_state->playlist->start_time = (time_t) NULL;
+        app_state->playlist->play_time = -1;
+        log_position(playlist);
+    }
+
+    dump(app_state);
+}
+
+/**
+ * Pauses or resumes playback of a song in the playlist.
+ *
+ * If there is a current song playing, this function sends a SIGSTOP signal to pause playback, or a SIGCONT signal to resume playback,
+ * depending on the current state of the playlist. It then updates the playlist state to reflect the new status.
+ *
+ * @param app_state A pointer to the current application state.
+ */
+void pause_resume(const AppState *const app_state)
+{
+    Playlist *const playlist = app_state->playlist;
+
+    // Check if there is a current song playing.
+    switch (playlist->status) {
+        case STOPPED:
+            // Resume the song restored from the journal, otherwise do nothing.
+            if (playlist->resume_position >= 0
+                && playlist->current_playing < playlist->size) {
+                play_song(app_state, playlist->current_playing);
+            }
+            break;
+        case PLAYING:
+            // Pause playback and update playlist state.
+            change_playback_status(playlist->pid, SIGSTOP);
+            playlist->status = PAUSED;
+            log_position(playlist);
+            break;
+        case PAUSED:
+            // Resume playback and update playlist state.
+            const time_t now = time(NULL);
+            playlist->start_time = now;
+            change_playback_status(playlist->pid, SIGCONT);
+            playlist->status = PLAYING;
+            break;
+    }
+
+    dump(app_state);
+    return;
+}
+
+/**
+ * Callback function used to receive data from a libcurl request and write it to a buffer.
+ *
+ * This function is called by libcurl whenever new data is received in response to a URL request. It appends the new data to the existing
+ * buffer pointed to by the `data` parameter, reallocating memory as necessary, and updates the size of the buffer accordingly.
+ *
+ * @param ptr A pointer to the received data.
+ * @param size The size of each data element.
+ * @param nmemb The number of elements received.
+ * @param data A pointer to a url_data struct containing information about the buffer being written to.
+ * @return The total number of bytes written to the buffer.
+ */
+int write_url_data(void *const ptr, const int size, const int nmemb,
+               struct url_data *const data)
+{
+    // Get the starting index and number of bytes to write.
+    const int start_index = data->size;
+    const int bytes_written = (size * nmemb);
+
+    // Resize the data buffer to accommodate the new data.
+    char *const new_data_ptr = realloc(data->data, data->size + bytes_written + 1);   // +1 for '\0'
+
+    if (new_data_ptr == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for URL data.\n");
+        if (data->data) {
+            free(data->data);
+            data->data = NULL;
+            data->size = 0;
+        }
+        return 0;
+    }
+
+    data->data = new_data_ptr;
+    memcpy((data->data + start_index), ptr, bytes_written);
+    data->size += bytes_written;
+    data->data[data->size] = '\0';
+
+    return bytes_written;
+}
+
+/* Path of each operation of the Subsonic API */
+static const char *const operation_paths[NUMBER_OPERATIONS] = {
+    [PING] = "rest/ping.view",
+    [ARTISTS] = "rest/getArtists",
+    [ALBUMS] = "rest/getArtist",
+    [SONGS] = "rest/getAlbum",
+    [PLAY] = "rest/stream",
+    [PLAYLISTS] = "rest/getPlaylists",
+    [PLAYLIST] = "rest/getPlaylist",
+    [CREATE_PLAYLIST] = "rest/createPlaylist",
+    [UPDATE_PLAYLIST] = "rest/updatePlaylist",
+    [SAVE_PLAY_QUEUE] = "rest/savePlayQueue",
+    [GET_PLAY_QUEUE] = "rest/getPlayQueue",
+    [SEARCH] = "rest/search3",
+    [SONG] = "rest/getSong",
+};
+
+/**
+ * Generates a Subsonic API URL for a given operation and query parameters.
+ *
+ * @param conn The connection settings to use for generating the URL.
+ * @param operation The operation to perform.
+ * @param params Additional query parameters, each starting with '&' and already escaped (optional).
+ * @param url A pointer to a char pointer to store the generated URL.
+ *
+ * @return void
+ *
+ * @note The memory for the generated URL is allocated dynamically and must be freed by the caller.
+ */
+void generate_subsonic_query(const Connection *const conn,
+                             enum Operation operation, const char *params,
+                             char **url)
+{
+    *url = NULL;
+
+    if (operation < 0 || operation >= NUMBER_OPERATIONS || conn->requests[operation] == NULL) {
+        fprintf(stderr, "Invalid operation.\n");
+        return;
+    }
+
+    params = params ? params : "";
+
+    // Only the parameters are added to the prebuilt URL of the operation
+    const int len_request = conn->request_lengths[operation];
+    const size_t len_params = strlen(params);
+
+    *url = malloc(sizeof(char) * (len_request + len_params + 1));
+    if (NULL == (*url)) {
+        fprintf(stderr, "Failed to allocate memory for the URL.\n");
+        return;
+    }
+
+    memcpy(*url, conn->requests[operation], len_request);
+    memcpy(*url + len_request, params, len_params + 1);
+}
+
+/**
+ * Generates a Subsonic API URL for a given operation and data.
+ *
+ * @param conn The connection settings to use for generating the URL.
+ * @param operation The operation to perform.
+ * @param data The data to include in the URL (optional).
+ * @param url A pointer to a char pointer to store the generated URL.
+ *
+ * @return void
+ * 
+ * @note The memory for the generated URL is allocated dynamically and must be freed by the caller.
+ */
+void generate_subsonic_url(const Connection *const conn, enum Operation operation,
+                      const char *data, char **url)
+{
+    if (data == NULL) {
+        generate_subsonic_query(conn, operation, NULL, url);
+        return;
+    }
+
+    const size_t len_params = strlen("&id=") + strlen(data) + 1;
+    char params[len_params];
+
+    snprintf(params, len_params, "&id=%s", data);
+    generate_subsonic_query(conn, operation, params, url);
+}
+
+/**
+ * Appends a URL-encoded query parameter to a growing buffer.
+ *
+ * @param query The buffer to append to; its data may be NULL when empty.
+ * @param key   The parameter name.
+ * @param value The parameter value, encoded as it is appended.
+ */
+void append_query(struct url_data *const query, const char *const key,
+                  const char *const value)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const size_t len_key = strlen(key);
+    const size_t len_value = strlen(value);
+
+    // Worst case every byte of the value is percent-encoded
+    char *const p = realloc(query->data,
+                            query->size + len_key + 3 * len_value + 3);
+
+    if (p == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the query.\n");
+        exit(EXIT_FAILURE);
+    }
+    query->data = p;
+
+    char *out = query->data + query->size;
+
+    *out++ = '&';
+    memcpy(out, key, len_key);
+    out += len_key;
+    *out++ = '=';
+    for (const unsigned char *c = (const unsigned char *) value; *c; c++) {
+        if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z')
+            || (*c >= '0' && *c <= '9') || strchr("-_.~", *c)) {
+            *out++ = *c;
+        } else {
+            *out++ = '%';
+            *out++ = hex[*c >> 4];
+            *out++ = hex[*c & 15];
+        }
+    }
+    *out = '\0';
+    query->size = out - query->data;
+}
+
+/**
+ * Computes the MD5 digest of a string, as the Subsonic API uses for authentication tokens.
+ *
+ * @param text   The string.
+ * @param digest Receives the digest as 32 lowercase hexadecimal digits and a terminator.
+ */
+void md5_hex(const char *const text, char digest[33])
+{
+    static const uint32_t k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+        0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+        0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+        0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+        0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+        0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+        0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+        0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+        0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+    static const int shifts[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+    const size_t length = strlen(text);
+    // Room for the 0x80 marker and the 64-bit length, rounded up to whole blocks
+    const size_t padded = (length + 8) / 64 * 64 + 64;
+    unsigned char *const message = calloc(padded, 1);
+    uint32_t state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+    if (message == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the token.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(message, text, length);
+    message[length] = 0x80;
+    for (int i = 0; i < 8; i++) {
+        message[padded - 8 + i] = (unsigned char) ((uint64_t) length * 8 >> (8 * i));
+    }
+
+    for (size_t block = 0; block < padded; block += 64) {
+        uint32_t words[16];
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+
+        for (int i = 0; i < 16; i++) {
+            const unsigned char *const p = message + block + 4 * i;
+
+            words[i] = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+        }
+        for (int i = 0; i < 64; i++) {
+            const int round = i / 16;
+            uint32_t f;
+            int g;
+
+            switch (round) {
+                case 0: f = (b & c) | (~b & d); g = i; break;
+                case 1: f = (d & b) | (~d & c); g = (5 * i + 1) % 16; break;
+                case 2: f = b ^ c ^ d; g = (3 * i + 5) % 16; break;
+                default: f = c ^ (b | ~d); g = 7 * i % 16; break;
+            }
+
+            const int shift = shifts[round * 4 + i % 4];
+            const uint32_t sum = a + f + k[i] + words[g];
+
+            a = d;
+            d = c;
+            c = b;
+            b += sum << shift | sum >> (32 - shift);
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    }
+    free(message);
+
+    for (int i = 0; i < 16; i++) {
+        snprintf(digest + 2 * i, 3, "%02x", (state[i / 4] >> (8 * (i % 4))) & 0xff);
+    }
+}
+
+/**
+ * Prepares a connection for requests: picks the session salt, derives the
+ * authentication token from it, and builds the URL of every operation up to its
+ * parameters, so a request only appends them.
+ *
+ * @param conn The connection.
+ */
+void init_connection(Connection *const conn)
+{
+    struct url_data query = { 0, NULL };
+
+    // A new salt each session, so a logged URL cannot be replayed forever
+    if (token_auth) {
+        unsigned char random[8] = { 0 };
+        const int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0 || read(fd, random, sizeof(random)) != (ssize_t) sizeof(random)) {
+            const uint64_t seed = (uint64_t) time(NULL) << 20 ^ (uint64_t) getpid();
+
+            memcpy(random, &seed, sizeof(random));
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        for (size_t i = 0; i < sizeof(random); i++) {
+            snprintf(conn->salt + 2 * i, 3, "%02x", random[i]);
+        }
+
+        struct url_data salted = { 0, NULL };
+
+        append_format(&salted, "%s%s", conn->password, conn->salt);
+        md5_hex(salted.data, conn->token);
+        free(salted.data);
+    }
+
+    append_query(&query, "f", "json");
+    append_query(&query, "u", conn->user);
+    if (token_auth) {
+        append_query(&query, "t", conn->token);
+        append_query(&query, "s", conn->salt);
+    } else {
+        append_query(&query, "p", conn->password);
+    }
+    append_query(&query, "v", conn->version);
+    append_query(&query, "c", conn->app);
+
+    for (int operation = 0; operation < NUMBER_OPERATIONS; operation++) {
+        struct url_data url = { 0, NULL };
+
+        // The query starts with '&', which becomes the '?' after the path
+        append_format(&url, "%s:%d/%s?%s", conn->url, conn->port,
+                      operation_paths[operation], query.data + 1);
+        conn->requests[operation] = url.data;
+        conn->request_lengths[operation] = url.size;
+    }
+    free(query.data);
+}
+
+/**
+ * Builds the connections to the servers listed in `servers`, each with its own
+ * bandwidth estimator.
+ */
+void init_connections(void)
+{
+    number_connections = sizeof(servers) / sizeof(servers[0]);
+    connections = calloc(number_connections, sizeof(Connection));
+    if (connections == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the connections.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < number_connections; i++) {
+        BandwidthEstimator *const bandwidth = malloc(sizeof(BandwidthEstimator));
+
+        if (bandwidth == NULL) {
+            fprintf(stderr, "Error: Failed to allocate memory for the connections.\n");
+            exit(EXIT_FAILURE);
+        }
+        *bandwidth = (BandwidthEstimator) {
+            .throughput = 0,
+            .samples = 0,
+            .profile = initial_profile,
+            .min_buffer = -1,
+        };
+        pthread_mutex_init(&bandwidth->lock, NULL);
+
+        connections[i] = (Connection) {
+            .name = servers[i].name,
+            .url = (char *) servers[i].url,
+            .port = servers[i].port,
+            .user = (char *) servers[i].user,
+            .password = (char *) servers[i].password,
+            .version = VERSION,
+            .app = APP,
+            .profiles = profiles,
+            .number_profiles = sizeof(profiles)/sizeof(profiles[0]),
+            .bandwidth = bandwidth,
+            .latency = 0,
+        };
+        init_connection(&connections[i]);
+    }
+}
+
+/**
+ * Returns the server with a given name.
+ *
+ * @param name The name of the server in `servers`.
+ * @return The server, or the first one if none has this name.
+ */
+const Connection *find_connection(const char *const name)
+{
+    for (int i = 0; i < number_connections; i++) {
+        if (strcmp(connections[i].name, name) == 0) {
+            return &connections[i];
+        }
+    }
+    return &connections[0];
+}
+
+/**
+ * Frees the copies of an artist, album or song.
+ *
+ * @param copies        The copies.
+ * @param number_copies The number of copies.
+ */
+void free_copies(Source *const copies, const int number_copies)
+{
+    for (int i = 0; i < number_copies; i++) {
+        free(copies[i].id);
+    }
+    free(copies);
+}
+
+/**
+ * Generates the URL to stream a song, requesting the format and maximum bitrate of a
+ * transcoding profile.
+ *
+ * @param conn    The connection settings to use for generating the URL.
+ * @param id      The ID of the song to stream.
+ * @param profile The transcoding profile to request.
+ * @param offset  The seconds to skip at the start of the song, honoured by servers
+ *                when transcoding.
+ *
+ * @return The generated URL, or NULL on failure.
+ *
+ * @note The memory for the generated URL is allocated dynamically and must be freed by the caller.
+ */
+char *generate_stream_url(const Connection *const conn, const char *const id,
+                          const TranscodeProfile *const profile, const int offset)
+{
+    char *base = NULL;
+
+    generate_subsonic_url(conn, PLAY, id, &base);
+    if (base == NULL) {
+        return NULL;
+    }
+
+    // Ask for an estimated length so transcoded streams report their size
+    const size_t len_url =
+        snprintf(NULL, 0, "%s&format=%s&maxBitRate=%d&estimateContentLength=true&timeOffset=%d",
+                 base, profile->format, profile->max_bitrate, offset) + 1;
+    char *const url = malloc(len_url);
+
+    if (url != NULL) {
+        snprintf(url, len_url,
+                 "%s&format=%s&maxBitRate=%d&estimateContentLength=true&timeOffset=%d",
+                 base, profile->format, profile->max_bitrate, offset);
+    } else {
+        fprintf(stderr, "Failed to allocate memory for the URL.\n");
+    }
+    free(base);
+    return url;
+}
+
+/**
+ * Fetches data from a given URL using libcurl and returns it as a string.
+ *
+ * @param url The URL to fetch data from.
+ *
+ * @return A pointer to the string containing the fetched data. This memory should be freed by the caller.
+ *         If an error occurs, NULL is returned.
+ */
+char *fetch_url_data(const char *const url)
+{
+    return post_url_data(url, NULL);
+}
+
+/**
+ * Sends form fields to a given URL using libcurl and returns the response as a string.
+ * Used instead of a GET when the parameters could be too long for a URL.
+ *
+ * @param url The URL to send the request to.
+ * @param fields The URL-encoded form fields to post, or NULL to issue a GET.
+ *
+ * @return A pointer to the string containing the response. This memory should be freed by the caller.
+ *         If an error occurs, NULL is returned.
+ */
+char *post_url_data(const char *const url, const char *const fields)
+{
+    CURL *const curl_handle = curl_easy_init();
+    const int initial_size = 4096;
+
+    struct url_data url_data = {
+        .size = 0,
+        .data = malloc(initial_size)
+    };
+
+    if (url_data.data == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    url_data.data[0] = '\0';
+
+    // If curl_handle failed, exit.
+    if (curl_handle == NULL) {
+        fprintf(stderr, "Error: Failed to initialize curl handle.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Set curl options and perform request.
+    curl_easy_setopt(curl_handle, CURLOPT_URL, url);
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_url_data);
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &url_data);
+    curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2);
+    if (fields != NULL) {
+        curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, fields);
+    }
+    const CURLcode curl_result = curl_easy_perform(curl_handle);
+
+    if (curl_result != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n",
+                curl_easy_strerror(curl_result));
+        free(url_data.data);
+        return NULL;
+    }
+    // Return fetched data and clean up.
+    curl_easy_cleanup(curl_handle);
+    return url_data.data;
+}
+
+/**
+ * Thread that sends a request for fetch_concurrently().
+ *
+ * @param arg The Fetch to send.
+ * @return NULL.
+ */
+static void *fetch_thread(void *const arg)
+{
+    Fetch *const fetch = arg;
+    const double start = monotonic_seconds();
+
+    fetch->response = request_subsonic(fetch->url, NULL, &fetch->root);
+    fetch->seconds = monotonic_seconds() - start;
+    return NULL;
+}
+
+/**
+ * Sends requests to the servers at the same time and waits for all of them, so a
+ * merged library costs the slowest server rather than the sum of all of them.
+ *
+ * @param fetches The requests; their responses are stored in place.
+ * @param count   The number of requests.
+ */
+void fetch_concurrently(Fetch *const fetches, const int count)
+{
+    for (int i = 0; i < count; i++) {
+        // A single request, or one that could not get a thread, is sent right away
+        fetches[i].threaded = count > 1
+            && pthread_create(&fetches[i].thread, NULL, &fetch_thread, &fetches[i]) == 0;
+        if (!fetches[i].threaded) {
+            fetch_thread(&fetches[i]);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (fetches[i].threaded) {
+            pthread_join(fetches[i].thread, NULL);
+        }
+    }
+}
+
+/**
+ * Frees the URLs and the responses of requests sent with fetch_concurrently().
+ *
+ * @param fetches The requests.
+ * @param count   The number of requests.
+ */
+void free_fetches(Fetch *const fetches, const int count)
+{
+    for (int i = 0; i < count; i++) {
+        free(fetches[i].url);
+        cJSON_Delete(fetches[i].root);
+    }
+    free(fetches);
+}
+
+/**
+ * Prepares one request per copy of an artist or album: the given ID on its origin
+ * server, then each of the copies on other servers.
+ *
+ * @param operation     The operation to request.
+ * @param origin        The server of the ID.
+ * @param id            The ID on the origin server.
+ * @param copies        The copies on other servers.
+ * @param number_copies The number of copies.
+ * @return The requests, to free with free_fetches().
+ */
+Fetch *source_fetches(const enum Operation operation, const Connection *const origin,
+                      const char *const id, const Source *const copies,
+                      const int number_copies)
+{
+    Fetch *const fetches = calloc(number_copies + 1, sizeof(Fetch));
+
+    if (fetches == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the requests.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i <= number_copies; i++) {
+        fetches[i].connection = i == 0 ? origin : copies[i - 1].connection;
+        generate_subsonic_url(fetches[i].connection, operation,
+                              i == 0 ? id : copies[i - 1].id, &fetches[i].url);
+    }
+    return fetches;
+}
+
+/**
+ * Adds a copy on another server to an artist, album or song.
+ *
+ * @param copies        The array of copies, reallocated.
+ * @param number_copies The number of copies, incremented.
+ * @param connection    The server holding the copy.
+ * @param id            The ID on that server; it is copied.
+ */
+void add_copy(Source **const copies, int *const number_copies,
+              const Connection *const connection, const char *const id)
+{
+    Source *const grown = realloc(*copies, (*number_copies + 1) * sizeof(Source));
+
+    if (grown == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the library.\n");
+        exit(EXIT_FAILURE);
+    }
+    *copies = grown;
+    (*copies)[(*number_copies)++] = (Source) { connection, strdup(id) };
+}
+
+/**
+ * Hashes a string ignoring case, to match the same name across servers.
+ *
+ * @param text The string.
+ * @return The hash.
+ */
+unsigned long text_hash(const char *const text)
+{
+    unsigned long hash = 5381;
+
+    for (const char *c = text; *c; c++) {
+        hash = hash * 33 + tolower((unsigned char) *c);
+    }
+    return hash;
+}
+
+/**
+ * Returns the ID of a song on a given server.
+ *
+ * @param song The song.
+ * @param conn The server.
+ * @return The ID, or NULL if the song is not on that server.
+ */
+const char *song_id(const Song *const song, const Connection *const conn)
+{
+    if (song->origin == conn) {
+        return song->id;
+    }
+    for (int i = 0; i < song->number_copies; i++) {
+        if (song->copies[i].connection == conn) {
+            return song->copies[i].id;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Chooses the server to stream a song from: the one with the lowest latency among
+ * those holding it.
+ *
+ * @param song The song.
+ * @return The server and the ID of the song on it.
+ */
+Source song_source(const Song *const song)
+{
+    Source best = { song->origin, song->id };
+
+    for (int i = 0; i < song->number_copies; i++) {
+        const Connection *const conn = song->copies[i].connection;
+
+        // An unreachable server has a negative latency
+        if (conn->latency >= 0
+            && (best.connection->latency < 0 || conn->latency < best.connection->latency)) {
+            best = song->copies[i];
+        }
+    }
+    return best;
+}
+
+/**
+ * Adds the artists of a getArtists response to the library. An artist already known
+ * from another server, by name regardless of case, gets this server as a copy.
+ *
+ * @param db       The library.
+ * @param capacity The number of artists allocated in the library, updated.
+ * @param buckets  Hash table of artist indices by name, chained through `chain`.
+ * @param number_buckets The size of the hash table.
+ * @param chain    Next artist index in the same bucket, reallocated with the library.
+ * @param conn     The server of the response.
+ * @param response The "subsonic-response" object.
+ */
+static void merge_artists(Database *const db, int *const capacity, int *const buckets,
+                          const int number_buckets, int **const chain,
+                          const Connection *const conn, const cJSON *const response)
+{
+    const cJSON *const index =
+        cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive
+                                         (response, "artists"), "index");
+    const cJSON *alphabetical_index;
+
+    cJSON_ArrayForEach(alphabetical_index, index) {
+        const cJSON *const artists_list =
+            cJSON_GetObjectItemCaseSensitive(alphabetical_index, "artist");
+        const cJSON *artist;
+
+        cJSON_ArrayForEach(artist, artists_list) {
+            const char *const id = json_string_value(artist, "id", NULL);
+            const char *const name = json_string_value(artist, "name", "");
+
+            if (id == NULL) {
+                continue;
+            }
+
+            int *const bucket = &buckets[text_hash(name) % number_buckets];
+            int found = *bucket;
+
+            while (found >= 0 && strcasecmp(db->artists[found].name, name) != 0) {
+                found = (*chain)[found];
+            }
+            if (found >= 0) {
+                Artist *const a = &db->artists[found];
+
+                add_copy(&a->copies, &a->number_copies, conn, id);
+                continue;
+            }
+
+            if (db->number_artists == *capacity) {
+                *capacity = MAX(2 * *capacity, 64);
+
+                Artist *const artists = realloc(db->artists, *capacity * sizeof(Artist));
+                int *const next = realloc(*chain, *capacity * sizeof(int));
+
+                if (artists == NULL || next == NULL) {
+                    fprintf(stderr, "Error: Failed to allocate memory for the library.\n");
+                    exit(EXIT_FAILURE);
+                }
+                db->artists = artists;
+                *chain = next;
+            }
+
+            Artist *const a = &db->artists[db->number_artists];
+
+            a->id = strdup(id);
+            a->name = strdup(name);
+            a->origin = conn;
+            a->copies = NULL;
+            a->number_copies = 0;
+            a->number_albums = 0;
+            a->albums = NULL;
+            (*chain)[db->number_artists] = *bucket;
+            *bucket = db->number_artists++;
+        }
+    }
+}
+
+static int compare_artists(const void *const a, const void *const b)
+{
+    return strcasecmp(((const Artist *) a)->name, ((const Artist *) b)->name);
+}
+
+/**
+ * Fetches the artists of every server at the same time and merges them into one
+ * library, measuring the latency of each server on the way.
+ *
+ * @param db The library to fill.
+ * @return 0, or -1 if no server answered.
+ *
+ * @remarks The caller is responsible for freeing the memory allocated for the Database struct.
+ */
+int get_library(Database *const db)
+{
+    // A ping and the artists of each server
+    Fetch *const fetches = calloc(2 * number_connections, sizeof(Fetch));
+    int capacity = 0;
+    int answered = 0;
+
+    if (fetches == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the requests.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < number_connections; i++) {
+        fetches[2 * i] = (Fetch) { .connection = &connections[i] };
+        fetches[2 * i + 1] = (Fetch) { .connection = &connections[i] };
+        generate_subsonic_url(&connections[i], PING, NULL, &fetches[2 * i].url);
+        generate_subsonic_url(&connections[i], ARTISTS, NULL, &fetches[2 * i + 1].url);
+    }
+    fetch_concurrently(fetches, 2 * number_connections);
+
+    // Artists are matched by name through a table sized for every response
+    int number_buckets = HASH_TABLE_SIZE;
+
+    for (int i = 0; i < number_connections; i++) {
+        const cJSON *const index = cJSON_GetObjectItemCaseSensitive(
+            cJSON_GetObjectItemCaseSensitive(fetches[2 * i + 1].response, "artists"),
+            "index");
+        const cJSON *alphabetical_index;
+
+        cJSON_ArrayForEach(alphabetical_index, index) {
+            number_buckets += cJSON_GetArraySize(
+                cJSON_GetObjectItemCaseSensitive(alphabetical_index, "artist"));
+        }
+    }
+
+    int *const buckets = malloc(number_buckets * sizeof(int));
+    int *chain = NULL;
+
+    if (buckets == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the library.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < number_buckets; i++) {
+        buckets[i] = -1;
+    }
+
+    db->artists = NULL;
+    db->number_artists = 0;
+    for (int i = 0; i < number_connections; i++) {
+        Connection *const conn = &connections[i];
+
+        conn->latency = fetches[2 * i].response != NULL ? fetches[2 * i].seconds : -1;
+        if (fetches[2 * i + 1].response == NULL) {
+            fprintf(stderr, "Error: Failed to retrieve artists from %s.\n", conn->name);
+            continue;
+        }
+        merge_artists(db, &capacity, buckets, number_buckets, &chain, conn,
+                      fetches[2 * i + 1].response);
+        answered++;
+    }
+
+    // A single server keeps its own order
+    if (number_connections > 1) {
+        qsort(db->artists, db->number_artists, sizeof(Artist), &compare_artists);
+    }
+
+    free(chain);
+    free(buckets);
+    free_fetches(fetches, 2 * number_connections);
+    return answered > 0 ? 0 : -1;
+}
+
+/**
+ * Finds an artist in the database based on the artist ID.
+ *
+ * @param db The database to search.
+ * @param artist_id The ID of the artist to find.
+ *
+ * @return The index of the artist in the database, or -1 if not found.
+ */
+int find_artist(const Database *const db, const char *const artist_id)
+{
+    // Check if the artist is already in the database
+    for (int i = 0; i < db->number_artists; i++) {
+        const Artist *const artist = &db->artists[i];
+
+        if (strcmp(artist->id, artist_id) == 0) {
+            // Artist is already in the database, return the album list
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Finds an album in the given artist's album list with the given ID.
+ *
+ * @param artist   The artist to search for the album in.
+ * @param album_id The ID of the album to search for.
+ *
+ * @return The index of the album in the artist's album list, or -1 if the album was not found.
+ */
+int find_album(const Artist *const artist, const char *const album_id)
+{
+    // Check if the artist is already in the database
+    for (int i = 0; i < artist->number_albums; i++) {
+        const Album *const album = &artist->albums[i];
+
+        if (strcmp(album->id, album_id) == 0) {
+            // Album is already in the database, return its index
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Tells whether two album entries from different servers are the same album: by
+ * MusicBrainz ID when both have one, and otherwise by name and year.
+ *
+ * @param a An album entry of getArtist.
+ * @param b Another album entry.
+ * @return 1 if they are the same album, 0 otherwise.
+ */
+int same_album(const cJSON *const a, const cJSON *const b)
+{
+    const char *const mbid_a = json_string_value(a, "musicBrainzId", "");
+    const char *const mbid_b = json_string_value(b, "musicBrainzId", "");
+
+    if (mbid_a[0] != '\0' && mbid_b[0] != '\0') {
+        return strcmp(mbid_a, mbid_b) == 0;
+    }
+    return strcasecmp(json_string_value(a, "name", ""), json_string_value(b, "name", "")) == 0
+        && json_int(a, "year", 0) == json_int(b, "year", 0);
+}
+
+/**
+ * Retrieves albums for an artist from a Subsonic server and stores them in the provided Artist struct.
+ * The albums of every server holding the artist are fetched at the same time, and an album
+ * found on several servers is listed once, with the other servers as copies.
+ *
+ * @param artist Artist struct to store the retrieved albums in
+ */
+void request_albums(Artist *const artist)
+{
+    if (artist->albums != NULL) {
+        // If album information for this artist has already been retrieved, return
+        return;
+    }
+
+    const int number_sources = artist->number_copies + 1;
+    Fetch *const fetches = source_fetches(ALBUMS, artist->origin, artist->id,
+                                          artist->copies, artist->number_copies);
+    int number_albums = 0;
+
+    fetch_concurrently(fetches, number_sources);
+    for (int i = 0; i < number_sources; i++) {
+        number_albums += cJSON_GetArraySize(cJSON_GetObjectItemCaseSensitive(
+            cJSON_GetObjectItemCaseSensitive(fetches[i].response, "artist"), "album"));
+    }
+    if (fetches[0].response == NULL && number_sources == 1) {
+        fprintf(stderr,
+                "Error: Failed to retrieve artists from Subsonic server/\n");
+        exit(EXIT_FAILURE);
+    }
+    if (number_albums == 0) {
+        free_fetches(fetches, number_sources);
+        return;                 // No albums found for this artist
+    }
+
+    // The entry each album was first seen with, to match the copies against
+    const cJSON **const entries = malloc(number_albums * sizeof(cJSON *));
+
+    artist->albums = malloc(sizeof(Album) * number_albums);
+    if (artist->albums == NULL || entries == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the library.\n");
+        exit(EXIT_FAILURE);
+    }
+    artist->number_albums = 0;
+
+    for (int i = 0; i < number_sources; i++) {
+        const cJSON *const albums = cJSON_GetObjectItemCaseSensitive(
+            cJSON_GetObjectItemCaseSensitive(fetches[i].response, "artist"), "album");
+        const cJSON *album;
+
+        cJSON_ArrayForEach(album, albums) {
+            const char *const id = json_string_value(album, "id", NULL);
+            int found = -1;
+
+            if (id == NULL) {
+                continue;
+            }
+            for (int j = 0; j < artist->number_albums && found < 0 && i > 0; j++) {
+                if (artist->albums[j].origin != fetches[i].connection
+                    && same_album(entries[j], album)) {
+                    found = j;
+                }
+            }
+            if (found >= 0) {
+                Album *const a = &artist->albums[found];
+
+                add_copy(&a->copies, &a->number_copies, fetches[i].connection, id);
+                continue;
+            }
+
+            Album *const a = &(artist->albums[artist->number_albums]);
+
+            entries[artist->number_albums++] = album;
+            a->id = strdup(id);
+            a->name = json_string(album, "name", "");
+            a->origin = fetches[i].connection;
+            a->copies = NULL;
+            a->number_copies = 0;
+            a->number_songs = 0;
+            a->songs = NULL;
+        }
+    }
+
+    free(entries);
+    free_fetches(fetches, number_sources);
+}
+
+/**
+ * Retrieves album information for a given artist from the server.
+ *
+ * This function retrieves album information for a given artist from the server
+ * by sending requests to the servers holding it. If the artist already has
+ * album information in the database, the function does nothing.
+ *
+ * @param db        Pointer to the Database object containing the artist and album information.
+ * @param artist_id The ID of the artist for which to retrieve album information.
+ */
+void get_albums(const Database *const db, const char *const artist_id)
+{
+    // Retrieve the position occupied by the artist in the database
+    const int artist_idx = find_artist(db, artist_id);
+
+    Artist *const artist = &(db->artists[artist_idx]);
+
+    // Check if the artist already has album information
+    if (artist->number_albums == 0) {
+        request_albums(artist);
+    }
+}
+
+/**
+ * Retrieves song information for a given album by an artist from the server.
+ *
+ * This function retrieves song information for a given album by an artist from the
+ * server by sending requests to the servers holding it. If the album already has
+ * song information in the database, the function does nothing.
+ *
+ * @param db        Pointer to the Database object containing the artist and album information.
+ * @param artist_id The ID of the artist for which to retrieve album information.
+ * @param album_id  The ID of the album for which to retrieve song information.
+ */
+void get_songs(const Database *const db, const char *const artist_id,
+               const char *const album_id)
+{
+    // Retrieve the position occupied by the artist in the database
+    const int artist_idx = find_artist(db, artist_id);
+    const Artist *const artist = &(db->artists[artist_idx]);
+
+    // Retrieve the position occupied by the album in the Artist struct 
+    const int album_idx = find_album(artist, album_id);
+    Album *const album = &(artist->albums[album_idx]);
+
+    // Check if the album already has song information
+    if (album->number_songs == 0) {
+        request_songs(album);
+    }
+}
+
+/**
+ * Calculates the approximate duration of a song based on its size and bit rate.
+ *
+ * This function calculates the approximate duration of a song based on its size and
+ * bit rate. It uses the formula: size*8/rate/1000 to compute the duration in seconds.
+ *
+ * @param song A JSON object representing the song to compute the duration for.
+ *             The object must have "size" and "bitRate" fields containing the size
+ *             of the song in bytes and its bit rate in kilobits per second (kbps),
+ *             respectively.
+ *
+ * @return The approximate duration of the song in seconds.
+ */
+int approximate_duration(const cJSON *const song)
+{
+    const int size = cJSON_GetObjectItemCaseSensitive(song, "size")->valueint;
+    const int rate =
+        cJSON_GetObjectItemCaseSensitive(song, "bitRate")->valueint;
+    return size * 8 / rate / 1000;
+}
+
+/**
+ * Tells whether two song entries from different servers are the same song: by disc,
+ * track number and title.
+ *
+ * @param a A song entry of getAlbum.
+ * @param b Another song entry.
+ * @return 1 if they are the same song, 0 otherwise.
+ */
+int same_song(const cJSON *const a, const cJSON *const b)
+{
+    return json_int(a, "discNumber", 1) == json_int(b, "discNumber", 1)
+        && json_int(a, "track", 0) == json_int(b, "track", 0)
+        && strcasecmp(json_string_value(a, "title", ""), json_string_value(b, "title", "")) == 0;
+}
+
+/**
+ * Retrieves song information for a given album from the Subsonic server.
+ *
+ * This function retrieves song information for a given album by sending a request to
+ * the Subsonic servers holding it. The retrieved information is stored
+ * in the provided Album object. If the album already has song information, the function
+ * does nothing.
+ *
+ * When the album is on several servers, all of them are asked at the same time and each
+ * song records its copies, so it can be streamed from the closest server.
+ *
+ * @param album Pointer to the Album object to store the retrieved song information.
+ */
+void request_songs(Album *const album)
+{
+    if (album->songs != NULL) {
+        // If album information for this artist has already been retrieved, return
+        return;
+    }
+
+    const int number_sources = album->number_copies + 1;
+    Fetch *const fetches = source_fetches(SONGS, album->origin, album->id,
+                                          album->copies, album->number_copies);
+    int number_songs = 0;
+
+    fetch_concurrently(fetches, number_sources);
+    if (fetches[0].response == NULL && number_sources == 1) {
+        fprintf(stderr,
+                "Error: Failed to retrieve artists from Subsonic server/\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < number_sources; i++) {
+        number_songs += cJSON_GetArraySize(cJSON_GetObjectItemCaseSensitive(
+            cJSON_GetObjectItemCaseSensitive(fetches[i].response, "album"), "song"));
+    }
+
+    // The entry each song was first seen with, to match the copies against
+    const cJSON **const entries = malloc(MAX(number_songs, 1) * sizeof(cJSON *));
+
+    album->songs = malloc(sizeof(Song) * MAX(number_songs, 1));
+    if (album->songs == NULL || entries == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the library.\n");
+        exit(EXIT_FAILURE);
+    }
+    album->number_songs = 0;
+
+    for (int i = 0; i < number_sources; i++) {
+        const cJSON *const album_json =
+            cJSON_GetObjectItemCaseSensitive(fetches[i].response, "album");
+        const cJSON *const songs = cJSON_GetObjectItemCaseSensitive(album_json, "song");
+        const cJSON *song;
+
+        cJSON_ArrayForEach(song, songs) {
+            const char *const id = json_string_value(song, "id", NULL);
+            int found = -1;
+
+            if (id == NULL) {
+                continue;
+            }
+            for (int j = 0; j < album->number_songs && found < 0 && i > 0; j++) {
+                if (album->songs[j].origin != fetches[i].connection
+                    && song_id(&album->songs[j], fetches[i].connection) == NULL
+                    && same_song(entries[j], song)) {
+                    found = j;
+                }
+            }
+            if (found >= 0) {
+                Song *const s = &album->songs[found];
+
+                add_copy(&s->copies, &s->number_copies, fetches[i].connection, id);
+                continue;
+            }
+
+            Song *const s = &(album->songs[album->number_songs]);
+
+            entries[album->number_songs++] = song;
+            s->id = strdup(id);
+            s->name = json_string(song, "title", "");
+            s->artist = json_string(song, "artist", json_string_value(album_json, "artist", ""));
+            s->album = json_string(song, "album", album->name);
+            s->duration = cJSON_HasObjectItem(song, "duration") ? 
+                cJSON_GetObjectItemCaseSensitive(song, "duration")->valueint :
+                approximate_duration(song);
+            s->origin = fetches[i].connection;
+            s->copies = NULL;
+            s->number_copies = 0;
+        }
+    }
+
+    free(entries);
+    free_fetches(fetches, number_sources);
+}
+/**
+ * Returns a string member of a JSON object.
+ *
+ * @param object   The JSON object.
+ * @param key      The member name.
+ * @param fallback The value returned if the member is missing or not a string.
+ * @return The member value, owned by the JSON tree, or the fallback.
+ */
+const char *json_string_value(const cJSON *const object, const char *const key,
+                              const char *const fallback)
+{
+    const cJSON *const item = cJSON_GetObjectItemCaseSensitive(object, key);
+
+    return cJSON_IsString(item) ? item->valuestring : fallback;
+}
+
+/**
+ * Returns a newly allocated copy of a string member of a JSON object.
+ *
+ * @param object   The JSON object.
+ * @param key      The member name.
+ * @param fallback The value copied if the member is missing or not a string.
+ * @return A copy of the member value that must be freed by the caller.
+ */
+char *json_string(const cJSON *const object, const char *const key,
+                  const char *const fallback)
+{
+    return strdup(json_string_value(object, key, fallback));
+}
+
+/**
+ * Returns an integer member of a JSON object.
+ *
+ * @param object   The JSON object.
+ * @param key      The member name.
+ * @param fallback The value returned if the member is missing or not a number.
+ * @return The member value, or the fallback.
+ */
+int json_int(const cJSON *const object, const char *const key,
+             const int fallback)
+{
+    const cJSON *const item = cJSON_GetObjectItemCaseSensitive(object, key);
+
+    return cJSON_IsNumber(item) ? item->valueint : fallback;
+}
+
+/**
+ * Requests a URL and returns the "subsonic-response" object if the server reports success.
+ * Unlike the library requests, failures are reported to the caller instead of exiting.
+ *
+ * @param url    The URL to request.
+ * @param fields Form fields to post, or NULL to issue a GET.
+ * @param root   Receives the parsed document, which the caller must free with cJSON_Delete.
+ * @return The "subsonic-response" object, or NULL on failure.
+ */
+cJSON *request_subsonic(const char *const url, const char *const fields,
+                        cJSON **const root)
+{
+    char *const response = post_url_data(url, fields);
+
+    *root = response ? cJSON_Parse(response) : NULL;
+    free(response);
+
+    cJSON *const subsonic_response =
+        cJSON_GetObjectItemCaseSensitive(*root, "subsonic-response");
+
+    if (strcmp("ok", json_string_value(subsonic_response, "status", "")) != 0) {
+        return NULL;
+    }
+    return subsonic_response;
+}
+
+/**
+ * Returns the song with a given ID on its server, creating a copy of the given song if it
+ * is not known yet. A song without origin belongs to the first server.
+ * Songs that appear in playlists or in the restored queue but whose albums were never browsed
+ * live in this table, so the same song is shared across playlists and stays valid until exit.
+ *
+ * @param song The song to look up; its strings are copied if it is added.
+ * @return The interned song.
+ */
+Song *intern_song_data(const Song *const song)
+{
+    unsigned long hash = 5381;
+
+    for (const char *c = song->id; *c; c++) {
+        hash = hash * 33 + (unsigned char) *c;
+    }
+
+    SongEntry **const bucket = &song_table[hash % HASH_TABLE_SIZE];
+    const Connection *const origin = song->origin ? song->origin : &connections[0];
+
+    // IDs are only unique within a server
+    for (SongEntry *entry = *bucket; entry != NULL; entry = entry->next) {
+        if (entry->song.origin == origin && strcmp(entry->song.id, song->id) == 0) {
+            return &entry->song;
+        }
+    }
+
+    SongEntry *const entry = malloc(sizeof(SongEntry));
+
+    if (entry == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for song.\n");
+        exit(EXIT_FAILURE);
+    }
+    entry->song = (Song) {
+        .id = strdup(song->id),
+        .name = strdup(song->name),
+        .artist = strdup(song->artist),
+        .album = strdup(song->album),
+        .duration = song->duration,
+        .origin = origin,
+        .copies = NULL,
+        .number_copies = 0,
+    };
+    entry->next = *bucket;
+    *bucket = entry;
+    return &entry->song;
+}
+
+/**
+ * Returns the song of a JSON song entry, interning it if it is not known yet.
+ *
+ * @param json A song entry as returned in playlists ("entry") or albums ("song").
+ * @return The interned song, or NULL if the entry has no ID.
+ */
+Song *intern_song(const cJSON *const json)
+{
+    const char *const id = json_string_value(json, "id", NULL);
+
+    if (id == NULL) {
+        return NULL;
+    }
+
+    const Song song = {
+        .id = (char *) id,
+        .name = (char *) json_string_value(json, "title", ""),
+        .artist = (char *) json_string_value(json, "artist", ""),
+        .album = (char *) json_string_value(json, "album", ""),
+        .duration = json_int(json, "duration", 0),
+        .origin = &connections[0],
+    };
+
+    return intern_song_data(&song);
+}
+
+/**
+ * Records the current contents of a named playlist as the state of the server.
+ * Playlists live on the first server, so songs only found on others are left out.
+ *
+ * @param playlist The named playlist that was just loaded or synced.
+ */
+static void mark_synced(NamedPlaylist *const playlist)
+{
+    for (int i = 0; i < playlist->number_synced; i++) {
+        free(playlist->synced[i]);
+    }
+    free(playlist->synced);
+
+    playlist->number_synced = 0;
+    playlist->synced = malloc(MAX(playlist->songs.size, 1) * sizeof(char *));
+    if (playlist->synced == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int node = song_node(&playlist->songs, 0); node != 0;
+         node = next_node(&playlist->songs, node)) {
+        const char *const id = song_id(playlist->songs.nodes[node].song, &connections[0]);
+
+        if (id != NULL) {
+            playlist->synced[playlist->number_synced++] = strdup(id);
+        }
+    }
+    playlist->synced_version = playlist->songs.version;
+}
+
+/**
+ * Fetches the list of playlists of the user from the server. Their entries are loaded
+ * lazily, the first time each playlist is shown.
+ *
+ * @param app_state Pointer to the AppState object where the playlists are stored.
+ */
+void get_playlists(AppState *const app_state)
+{
+    char *url = NULL;
+    cJSON *root = NULL;
+
+    generate_subsonic_query(app_state->connection, PLAYLISTS, NULL, &url);
+
+    const cJSON *const subsonic_response = request_subsonic(url, NULL, &root);
+    const cJSON *const list = cJSON_GetObjectItemCaseSensitive(
+        cJSON_GetObjectItemCaseSensitive(subsonic_response, "playlists"),
+        "playlist");
+    const int number_playlists = cJSON_GetArraySize(list);
+
+    if (subsonic_response == NULL) {
+        fprintf(stderr, "Error: Failed to retrieve playlists from Subsonic server.\n");
+    } else if (number_playlists > 0) {
+        app_state->playlists = calloc(number_playlists, sizeof(NamedPlaylist));
+        if (app_state->playlists == NULL) {
+            fprintf(stderr, "Error: Failed to allocate memory for playlists.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        const cJSON *item;
+        int i = 0;
+
+        cJSON_ArrayForEach(item, list) {
+            NamedPlaylist *const playlist = &app_state->playlists[i++];
+
+            playlist->id = json_string(item, "id", "");
+            playlist->name = json_string(item, "name", "");
+            playlist->number_songs = json_int(item, "songCount", 0);
+            playlist->songs = init_playlist();
+        }
+        app_state->number_playlists = number_playlists;
+    }
+
+    cJSON_Delete(root);
+    free(url);
+}
+
+/**
+ * Fetches the entries of a named playlist from the server, if not loaded yet.
+ *
+ * @param conn     Connection struct containing information about the Subsonic server
+ * @param playlist The named playlist to load.
+ */
+void request_playlist(const Connection *const conn,
+                      NamedPlaylist *const playlist)
+{
+    if (playlist->loaded || playlist->id == NULL) {
+        return;
+    }
+
+    char *url = NULL;
+    cJSON *root = NULL;
+
+    generate_subsonic_url(conn, PLAYLIST, playlist->id, &url);
+
+    const cJSON *const subsonic_response = request_subsonic(url, NULL, &root);
+
+    if (subsonic_response == NULL) {
+        fprintf(stderr, "Error: Failed to retrieve playlist from Subsonic server.\n");
+        cJSON_Delete(root);
+        free(url);
+        return;
+    }
+
+    const cJSON *const entries = cJSON_GetObjectItemCaseSensitive(
+        cJSON_GetObjectItemCaseSensitive(subsonic_response, "playlist"),
+        "entry");
+    const int number_entries = cJSON_GetArraySize(entries);
+    Song **const songs = malloc(MAX(number_entries, 1) * sizeof(Song *));
+    const cJSON *entry;
+    int n = 0;
+
+    if (songs == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    cJSON_ArrayForEach(entry, entries) {
+        Song *const song = intern_song(entry);
+
+        if (song != NULL) {
+            songs[n++] = song;
+        }
+    }
+
+    clear_songs(&playlist->songs);
+    insert_songs(&playlist->songs, 0, songs, n);
+    mark_synced(playlist);
+    playlist->loaded = 1;
+
+    free(songs);
+    cJSON_Delete(root);
+    free(url);
+}
+
+/**
+ * Pushes the local changes of a named playlist to the server in a single request.
+ *
+ * A new playlist is created with createPlaylist. An existing one is patched with
+ * updatePlaylist: the longest prefix of the local list that appears, in order, on the
+ * server is kept, the other server entries are removed by index, and the rest of the
+ * local list is appended. Unchanged playlists cost no request at all.
+ *
+ * @param conn     Connection struct containing information about the Subsonic server
+ * @param playlist The named playlist to sync.
+ * @return 0 on success, -1 on failure.
+ */
+int sync_playlist(const Connection *const conn, NamedPlaylist *const playlist)
+{
+    if (playlist->id != NULL && playlist->synced_version == playlist->songs.version) {
+        return 0;
+    }
+
+    const Playlist *const songs = &playlist->songs;
+    struct url_data fields = { .size = 0, .data = NULL };
+    char number[16];
+    int node = song_node(songs, 0);
+
+    if (playlist->id == NULL) {
+        append_query(&fields, "name", playlist->name);
+    } else {
+        char *const kept = calloc(MAX(playlist->number_synced, 1), sizeof(char));
+        int j = 0;
+
+        if (kept == NULL) {
+            fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Match the local songs against the server order until one is out of place
+        for (; node != 0; node = next_node(songs, node)) {
+            const char *const id = song_id(songs->nodes[node].song, conn);
+
+            if (id == NULL) {
+                continue;
+            }
+            while (j < playlist->number_synced && strcmp(playlist->synced[j], id) != 0) {
+                j++;
+            }
+            if (j == playlist->number_synced) {
+                break;
+            }
+            kept[j++] = 1;
+        }
+
+        append_query(&fields, "playlistId", playlist->id);
+        for (int i = 0; i < playlist->number_synced; i++) {
+            if (!kept[i]) {
+                snprintf(number, sizeof(number), "%d", i);
+                append_query(&fields, "songIndexToRemove", number);
+            }
+        }
+        free(kept);
+    }
+
+    // Everything past the kept prefix is appended
+    for (; node != 0; node = next_node(songs, node)) {
+        const char *const id = song_id(songs->nodes[node].song, conn);
+
+        if (id != NULL) {
+            append_query(&fields, playlist->id == NULL ? "songId" : "songIdToAdd", id);
+        }
+    }
+
+    char *url = NULL;
+    cJSON *root = NULL;
+
+    generate_subsonic_query(conn,
+                            playlist->id == NULL ? CREATE_PLAYLIST : UPDATE_PLAYLIST,
+                            NULL, &url);
+
+    // The fields start with '&', which form encoding tolerates as an empty field
+    const cJSON *const subsonic_response =
+        request_subsonic(url, fields.data ? fields.data : "", &root);
+
+    if (subsonic_response != NULL && playlist->id == NULL) {
+        playlist->id = json_string(
+            cJSON_GetObjectItemCaseSensitive(subsonic_response, "playlist"),
+            "id", NULL);
+    }
+    if (subsonic_response != NULL) {
+        mark_synced(playlist);
+        playlist->loaded = 1;
+    } else {
+        fprintf(stderr, "Error: Failed to save playlist on Subsonic server.\n");
+    }
+
+    cJSON_Delete(root);
+    free(fields.data);
+    free(url);
+    return subsonic_response != NULL && playlist->id != NULL ? 0 : -1;
+}
+
+/**
+ * Creates a new named playlist holding the songs of another one, and saves it on the server.
+ *
+ * @param app_state Pointer to the AppState object where the playlists are stored.
+ * @param name      The name of the new playlist.
+ * @param source    The playlist whose songs are copied.
+ * @return The index of the new playlist.
+ */
+int create_named_playlist(AppState *const app_state, const char *const name,
+                          const Playlist *const source)
+{
+    NamedPlaylist *const p = realloc(app_state->playlists,
+                                     (app_state->number_playlists + 1) *
+                                     sizeof(NamedPlaylist));
+
+    if (p == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlists.\n");
+        exit(EXIT_FAILURE);
+    }
+    app_state->playlists = p;
+
+    NamedPlaylist *const playlist = &p[app_state->number_playlists];
+
+    *playlist = (NamedPlaylist) {
+        .id = NULL,
+        .name = strdup(name),
+        .loaded = 1,
+        .songs = init_playlist(),
+    };
+
+    Song **const songs = malloc(MAX(source->size, 1) * sizeof(Song *));
+    int n = 0;
+
+    if (songs == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int node = song_node(source, 0); node != 0; node = next_node(source, node)) {
+        songs[n++] = source->nodes[node].song;
+    }
+    insert_songs(&playlist->songs, 0, songs, n);
+    free(songs);
+
+    sync_playlist(app_state->connection, playlist);
+    return app_state->number_playlists++;
+}
+
+/**
+ * Saves the queue and the playback position on the server with savePlayQueue,
+ * so other clients can pick them up.
+ *
+ * @param app_state Pointer to the AppState object holding the queue.
+ */
+void save_play_queue(const AppState *const app_state)
+{
+    const Playlist *const playlist = app_state->playlist;
+    struct url_data fields = { 0, NULL };
+    char number[16];
+
+    // The queue is saved on the first server, with the songs it holds
+    const Connection *const conn = app_state->connection;
+    const char *current = NULL;
+
+    for (int node = song_node(playlist, 0); node != 0;
+         node = next_node(playlist, node)) {
+        const char *const id = song_id(playlist->nodes[node].song, conn);
+
+        if (id != NULL) {
+            append_query(&fields, "id", id);
+        }
+    }
+    if (playlist->current_playing < playlist->size) {
+        current = song_id(playlist_song(playlist, playlist->current_playing), conn);
+    }
+    if (current != NULL) {
+        append_query(&fields, "current", current);
+        snprintf(number, sizeof(number), "%d", playback_position(playlist) * 1000);
+        append_query(&fields, "position", number);
+    }
+
+    char *url = NULL;
+    cJSON *root = NULL;
+
+    generate_subsonic_query(conn, SAVE_PLAY_QUEUE, NULL, &url);
+    if (request_subsonic(url, fields.data ? fields.data : "", &root) == NULL) {
+        fprintf(stderr, "Error: Failed to save the play queue on Subsonic server.\n");
+    }
+
+    cJSON_Delete(root);
+    free(fields.data);
+    free(url);
+}
+
+/**
+ * Restores the queue and the playback position saved on the server with getPlayQueue.
+ *
+ * @param app_state Pointer to the AppState object holding the queue, still empty.
+ */
+void get_play_queue(AppState *const app_state)
+{
+    Playlist *const playlist = app_state->playlist;
+    char *url = NULL;
+    cJSON *root = NULL;
+
+    generate_subsonic_query(app_state->connection, GET_PLAY_QUEUE, NULL, &url);
+
+    const cJSON *const queue = cJSON_GetObjectItemCaseSensitive(
+        request_subsonic(url, NULL, &root), "playQueue");
+    const cJSON *const entries = cJSON_GetObjectItemCaseSensitive(queue, "entry");
+    const char *const current = json_string_value(queue, "current", "");
+    const int number_entries = cJSON_GetArraySize(entries);
+    Song **const songs = malloc(MAX(number_entries, 1) * sizeof(Song *));
+    int number_songs = 0;
+    int current_index = -1;
+
+    if (songs == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const cJSON *entry;
+
+    cJSON_ArrayForEach(entry, entries) {
+        Song *const song = intern_song(entry);
+
+        if (song == NULL) {
+            continue;
+        }
+        if (current_index < 0 && strcmp(song->id, current) == 0) {
+            current_index = number_songs;
+        }
+        songs[number_songs++] = song;
+    }
+    insert_songs(playlist, playlist->size, songs, number_songs);
+
+    if (current_index >= 0) {
+        playlist->current_playing = current_index;
+        playlist->playing_node = song_node(playlist, current_index);
+        playlist->resume_position = json_int(queue, "position", 0) / 1000;
+        log_position(playlist);
+    }
+
+    free(songs);
+    cJSON_Delete(root);
+    free(url);
+}
+
+/**
+ * Returns the playlist shown in the playlist view: the play queue or a named playlist.
+ *
+ * @param app_state Pointer to the AppState object.
+ * @return The playlist being viewed and edited.
+ */
+Playlist *viewed_playlist(const AppState *const app_state)
+{
+    if (app_state->viewed_playlist < 0) {
+        return app_state->playlist;
+    }
+    return &app_state->playlists[app_state->viewed_playlist].songs;
+}
+
+/**
+ * Shows the next or previous named playlist in the playlist view, loading its entries
+ * on first use. The play queue comes before the first named playlist.
+ *
+ * @param app_state Pointer to the AppState object.
+ * @param offset    1 to move forward, -1 to move back.
+ */
+void switch_playlist(AppState *const app_state, const int offset)
+{
+    const int count = app_state->number_playlists + 1;
+    const int viewed = ((app_state->viewed_playlist + 1 + offset) % count + count) % count - 1;
+
+    app_state->viewed_playlist = viewed;
+    app_state->selection_anchor = -1;
+    if (viewed >= 0) {
+        request_playlist(app_state->connection, &app_state->playlists[viewed]);
+    }
+}
+
+/**
+ * Plays the previous or next song in the playlist.
+ *
+ * This function plays the previous or next song in the playlist depending on the
+ * action provided. If the current song is the first/last one in the playlist and
+ * the user triggers a "previous"/"next" action, the function does nothing.
+ *
+ * @param app_state Pointer to the AppState object containing the current state
+ *                  of the application.
+ * @param action    An integer constant representing the action to perform. It can take
+ *                  one of two values: `previous` (to play the previous song) or `next`
+ *                  (to play the next song).
+ */
+void play_previous_next(AppState *const app_state, const int action)
 {
-    if (query == NULL) {
+    Playlist *const playlist = app_state->playlist;
+
+    if (playlist->shuffle_repeat_status == SHUFFLE) {
+        const int index = action == next ? shuffle_next(playlist) :
+            action == previous ? shuffle_previous(playlist) : -1;
+
+        if (index >= 0) {
+            play_song(app_state, index);
+        }
         return;
     }
 
-    int start, end, step;
-    
     switch (action) {
-        case search_previous:
-            start = *current_found - 1;
-            end = 0;
-            step = -1;
+        case previous:
+            if (playlist->current_playing > 0) {
+                --(playlist->current_playing);
+                play_song(app_state, playlist->current_playing);
+            }
             break;
-        case search_next:
-            start = *current_found + 1;
-            end = n_matches;
-            step = 1;
+        case next:
+            if (playlist->current_playing < playlist->size - 1) {
+                ++(playlist->current_playing);
+                play_song(app_state, playlist->current_playing);
+            }
             break;
         default:
-            start = 0;
-            end = n_matches;
-            step = 1;
             break;
     }
-
-    for (int i = start; i != end; i += step) {
-        if (strstr(possible_matches[i], query) != NULL) {
-            *idx_to_update = i;
-            *current_found = i;
-            return; // Found a match, exit the loop
-        }
-    }
 }
 
 /**
- * Search for a query in the current view and update the selected index.
+ * Adds songs to the playlist based on the current panel of the application.
  *
- * @param app_state The application state.
+ * This function adds songs to the playlist based on the current panel of the
+ * application. In the "Artists" panel it adds all songs from all albums of the selected
+ * artists, in the "Albums" panel all songs from the selected albums, and in the "Songs"
+ * panel the selected songs. The selection is the visual selection if one is active, or
+ * the highlighted row otherwise.
+ *
+ * The songs are counted first and gathered into one array, so the playlist grows once and
+ * receives them as a single contiguous run regardless of how many albums they span.
+ *
+ * @param app_state Pointer to the AppState object containing the current state of the
+ *                  application.
+ * @param playlist  The playlist receiving the songs.
+ *
+ * @return The index of the first song that was added to the playlist (0-indexed), or 0 if
+ *         no songs were added to the playlist.
  */
-void search_idx(AppState *app_state)
+int add_to_playlist(AppState *app_state, Playlist *const playlist)
 {
-    WINDOW *playback_window = *app_state->windows[WINDOW_PLAYBACK];
-    ViewType current_view = app_state->current_view;
-    PanelType current_panel = app_state->current_panel;
+    const Database *const db = app_state->db;
+    const int first_song_to_play = playlist->size;
+    const int has_songs = playlist->size == 0 ? 0 : 1;
+    const PanelType current_panel = app_state->current_panel;
+    int first;
+    int last;
+    int count = 0;
 
+    selection_range(app_state, &first, &last);
+    if (first < 0) {
+        return 0;
+    }
 
-    const int n_matches = current_view == WINDOW_PLAYLIST ? app_state->playlist->size : 
-                          current_panel == PANEL_ARTISTS ? app_state->db->number_artists :
-                          current_panel == PANEL_ALBUMS ? app_state->artist->number_albums :
-                          current_panel == PANEL_SONGS ? app_state->album->number_songs : 0;
-    if (n_matches == 0) {
-        return;
+    // Load whatever the selection covers and count its songs
+    switch (current_panel) {
+        case PANEL_ARTISTS:
+            for (int a = first; a <= last; ++a) {
+                Artist *const artist = &db->artists[a];
+
+                request_albums(artist);
+                for (int i = 0; i < artist->number_albums; ++i) {
+                    request_songs(&artist->albums[i]);
+                    count += artist->albums[i].number_songs;
+                }
+            }
+            break;
+        case PANEL_ALBUMS:
+            for (int i = first; i <= last; ++i) {
+                request_songs(&app_state->artist->albums[i]);
+                count += app_state->artist->albums[i].number_songs;
+            }
+            break;
+        case PANEL_SONGS:
+            count = last - first + 1;
+            break;
+        default:
+            break;
     }
 
-    const char *possible_matches[n_matches];
+    Song **const songs = malloc(MAX(count, 1) * sizeof(Song *));
+    int n = 0;
 
-    int *idx_to_update = NULL;
-    if (current_view == WINDOW_PLAYLIST) {
-        for (int i = 0; i < n_matches; i++) {
-            possible_matches[i] = app_state->playlist->songs[i]->name;
-        }
-        idx_to_update = &app_state->playlist->selected_song_idx;
-    } else {
-        if (current_panel == PANEL_ARTISTS) {
-            for (int i = 0; i < n_matches; i++) {
-                possible_matches[i] = app_state->db->artists[i].name;
+    if (songs == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    switch (current_panel) {
+        case PANEL_ARTISTS:
+            for (int a = first; a <= last; ++a) {
+                const Artist *const artist = &db->artists[a];
+
+                for (int i = 0; i < artist->number_albums; ++i) {
+                    const Album *const album = &artist->albums[i];
+
+                    for (int j = 0; j < album->number_songs; ++j) {
+                        songs[n++] = &album->songs[j];
+                    }
+                }
             }
-            idx_to_update = &app_state->selected_artist_idx;
-        }
-        if (current_panel == PANEL_ALBUMS) {
-            for (int i = 0; i < n_matches; i++) {
-                possible_matches[i] = app_state->artist->albums[i].name;
+            break;
+        case PANEL_ALBUMS:
+            for (int i = first; i <= last; ++i) {
+                const Album *const album = &app_state->artist->albums[i];
+
+                for (int j = 0; j < album->number_songs; ++j) {
+                    songs[n++] = &album->songs[j];
+                }
             }
-            idx_to_update = &app_state->selected_album_idx;
-        }
-        if (current_panel == PANEL_SONGS) {
-            for (int i = 0; i < n_matches; i++) {
-                possible_matches[i] = app_state->album->songs[i].name;
+            break;
+        case PANEL_SONGS:
+            for (int i = first; i <= last; ++i) {
+                songs[n++] = &app_state->album->songs[i];
             }
-            idx_to_update = &app_state->selected_song_idx;
+            break;
+        default:
+            break;
+    }
+
+    insert_songs(playlist, playlist->size, songs, n);
+    free(songs);
+    app_state->selection_anchor = -1;
+
+    return has_songs ?  first_song_to_play : 0;
+}
+
+/**
+ * Plays the song selected in the playlist view. For a named playlist, its songs first
+ * replace the play queue.
+ *
+ * @param app_state Pointer to the AppState object containing the current state of the
+ *                  application.
+ */
+void play_viewed_playlist(AppState *const app_state)
+{
+    Playlist *const queue = app_state->playlist;
+    const Playlist *const source = viewed_playlist(app_state);
+    const int index = source->selected_song_idx;
+
+    if (source != queue) {
+        Song **const songs = malloc(MAX(source->size, 1) * sizeof(Song *));
+        int n = 0;
+
+        if (songs == NULL) {
+            fprintf(stderr, "Error: Failed to allocate memory for playlist.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int node = song_node(source, 0); node != 0;
+             node = next_node(source, node)) {
+            songs[n++] = source->nodes[node].song;
         }
+        stop_playback(app_state);
+        clear_songs(queue);
+        insert_songs(queue, 0, songs, n);
+        queue->selected_song_idx = index;
+        free(songs);
     }
 
-    wclear(playback_window);
-    wprintw(playback_window, "Search: ");
-    wrefresh(playback_window);
+    if (index >= 0) {
+        play_song(app_state, index);
+    }
+}
 
-    char query[MAX_QUERY_LENGTH] = { 0 };
-    int c;
+/**
+ * Reads a line of text typed in the playback window.
+ *
+ * @param app_state Pointer to the AppState object.
+ * @param label     The prompt shown before the text.
+ * @param text      Receives the text typed.
+ * @param size      The size of the text buffer.
+ * @return 0 if the text was confirmed with ENTER, -1 if it was cancelled with ESC.
+ */
+int prompt_text(const AppState *const app_state, const char *const label,
+                char *const text, const int size)
+{
+    WINDOW *const playback_window = *app_state->windows[WINDOW_PLAYBACK];
+    const int label_len = strlen(label);
     int i = 0;
-    int current_found = 0;
+    int c;
+
+    werase(playback_window);
+    wprintw(playback_window, "%s", label);
+    wrefresh(playback_window);
 
     while ((c = getch()) != '\n') {
         switch (c) {
             case -1:
                 break;
             case 27:
-                return;
-                break;
-            case '\n':
-                query[i] = '\0';
-                break;
+                return -1;
             case 127:
             case KEY_BACKSPACE:
             case KEY_DC:
                 if (i > 0) {
-                    query[--i] = '\0';
-                    mvwaddch(playback_window, 0, strlen("Search: ") + i, ' ');
+                    text[--i] = '\0';
+                    mvwaddch(playback_window, 0, label_len + i, ' ');
                 }
                 break;
             default:
-                if (i < MAX_QUERY_LENGTH - 1) {
-                    mvwaddch(playback_window, 0, strlen("Search: ") + i, c);
-                    query[i++] = c;
+                if (i < size - 1 && c >= ' ' && c < KEY_MIN) {
+                    mvwaddch(playback_window, 0, label_len + i, c);
+                    text[i++] = c;
                 }
                 break;
         }
-        
-        // Print any new characters entered
         wrefresh(playback_window);
+    }
+    text[i] = '\0';
+    return 0;
+}
 
-        // Update the artist and album based on the query
-        update_selected_index(possible_matches, n_matches, query, 0, &current_found, idx_to_update);
-        Artist *const artist =
-            &(app_state->db->artists[app_state->selected_artist_idx]);
-        app_state->artist = artist;
-        get_albums(app_state->connection, app_state->db, artist->id);
-        Album *const album = &(artist->albums[app_state->selected_album_idx]);
+/**
+ * Returns the path of a runtime file such as a socket, creating the directories leading to it.
+ *
+ * @param name The file name; relative names are resolved in $XDG_RUNTIME_DIR/sksonic,
+ *             or like state_path() if it is not set.
+ * @return The path, which must be freed by the caller, or NULL if there is no suitable directory.
+ */
+char *runtime_path(const char *const name)
+{
+    const char *const runtime = getenv("XDG_RUNTIME_DIR");
 
-        app_state->album = album;
-        get_songs(app_state->connection, app_state->db, artist->id, album->id);
-    
-        // Refresh
-        if (current_view == VIEW_PLAYLIST) {
-            print_playlist_data(app_state,app_state->windows[WINDOW_PLAYLIST]);
-        } else {
-            // Refresh all panels (we could also refresh the child panel)
-            for (int i = 0; i < NUM_PANELS; i++) {   
-                print_window_data(app_state, i, app_state->windows[WINDOW_INFO]);
-            }
-        }
+    if (name[0] == '/' || runtime == NULL || runtime[0] != '/') {
+        return state_path(name);
     }
-    int action = -1;
-    while (1) {
-        c = getch();
-        action = get_action(c);
-        switch (action) {
-            case add_and_play:
-                if (app_state->current_view == VIEW_INFO) {
-                    const int first_song_to_play = add_to_playlist(app_state);
-                    play_song(app_state, first_song_to_play);
-                }
-                if (app_state->current_view == VIEW_PLAYLIST) {
-                    play_song(app_state, app_state->playlist->selected_song_idx);
-                    refresh_windows(app_state, app_state->windows[WINDOW_PLAYLIST], 1);
-                }
-                return;
-                break;
-            case add:
-                add_to_playlist(app_state);
-                return;
-                break;
-            case search_next:
-            case search_previous:
-                update_selected_index(possible_matches, n_matches, query, action, &current_found, idx_to_update);
-                
-                // Update the artist and album as we request next or previous
-                Artist *const artist =
-                    &(app_state->db->artists[app_state->selected_artist_idx]);
-                app_state->artist = artist;
-                get_albums(app_state->connection, app_state->db, artist->id);
-                Album *const album = &(artist->albums[app_state->selected_album_idx]);
 
-                app_state->album = album;
-                get_songs(app_state->connection, app_state->db, artist->id, album->id);
+    struct url_data path = { 0, NULL };
 
-                // Refresh
-                if (current_view == VIEW_PLAYLIST) {
-                    print_playlist_data(app_state,app_state->windows[WINDOW_PLAYLIST]);
-                } else {
-                    // Refresh all panels (we could also refresh the child panel)
-                    for (int i = 0; i < NUM_PANELS; i++) {   
-                        print_window_data(app_state, i, app_state->windows[WINDOW_INFO]);
-                    }
-                }
-                break;
-            default:
-                break;
+    append_format(&path, "%s/sksonic/%s", runtime, name);
+
+    char *const slash = strrchr(path.data, '/');
+
+    *slash = '\0';
+    mkdir(path.data, 0700);
+    *slash = '/';
+    return path.data;
+}
+
+/**
+ * Queues a message for clients of the control socket.
+ *
+ * @param client  The ID of the client, or -1 for every client subscribed to the events.
+ * @param message The message, sent as one line of JSON.
+ */
+void control_send(const int client, const cJSON *const message)
+{
+    ControlServer *const server = &control_server;
+    char *const json = cJSON_PrintUnformatted(message);
+
+    if (json == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < server->number_clients; i++) {
+        ControlClient *const c = &server->clients[i];
+
+        // Events are dropped for a subscriber that stopped reading them
+        if (client < 0 ? c->subscribed && c->output.size < CONTROL_BUFFER_LIMIT
+            : c->id == client) {
+            append_format(&c->output, "%s\n", json);
         }
+    }
+    pthread_mutex_unlock(&server->lock);
+    free(json);
+
+    // Wake up the control thread to send the message
+    if (write(server->notify[1], "", 1) < 0) {
+        // The pipe is full, so the thread is already due to wake up
+    }
+}
+
+/**
+ * Sends the result of a command to a client of the control socket.
+ *
+ * @param client The ID of the client.
+ * @param error  The error message, or NULL if the command succeeded.
+ */
+static void control_result(const int client, const char *const error)
+{
+    cJSON *const reply = cJSON_CreateObject();
+
+    cJSON_AddBoolToObject(reply, "ok", error == NULL);
+    if (error != NULL) {
+        cJSON_AddStringToObject(reply, "error", error);
+    }
+    control_send(client, reply);
+    cJSON_Delete(reply);
+}
+
+/**
+ * Searches songs on the server with search3 and sends them to a client.
+ *
+ * @param server  The control server.
+ * @param client  The ID of the client.
+ * @param request The "search" command, with a "query" and an optional "count".
+ */
+static void control_search(const ControlServer *const server, const int client,
+                           const cJSON *const request)
+{
+    struct url_data params = { 0, NULL };
+    char number[16];
+
+    snprintf(number, sizeof(number), "%d", json_int(request, "count", 20));
+    append_query(&params, "query", json_string_value(request, "query", ""));
+    append_query(&params, "songCount", number);
+    append_query(&params, "artistCount", "0");
+    append_query(&params, "albumCount", "0");
+
+    char *url = NULL;
+    cJSON *root = NULL;
 
-        if (action != search_next && action != search_previous && c != -1) {
-            break;
+    generate_subsonic_query(server->connection, SEARCH, params.data, &url);
+
+    const cJSON *const result = cJSON_GetObjectItemCaseSensitive(
+        request_subsonic(url, NULL, &root), "searchResult3");
+
+    if (result == NULL) {
+        control_result(client, "search failed");
+    } else {
+        cJSON *const reply = cJSON_CreateObject();
+        cJSON *const songs = cJSON_AddArrayToObject(reply, "songs");
+        const cJSON *song;
+
+        cJSON_AddBoolToObject(reply, "ok", 1);
+        cJSON_ArrayForEach(song, cJSON_GetObjectItemCaseSensitive(result, "song")) {
+            cJSON *const item = cJSON_CreateObject();
+
+            cJSON_AddStringToObject(item, "id", json_string_value(song, "id", ""));
+            cJSON_AddStringToObject(item, "title", json_string_value(song, "title", ""));
+            cJSON_AddStringToObject(item, "artist", json_string_value(song, "artist", ""));
+            cJSON_AddStringToObject(item, "album", json_string_value(song, "album", ""));
+            cJSON_AddNumberToObject(item, "duration", json_int(song, "duration", 0));
+            cJSON_AddItemToArray(songs, item);
         }
+        control_send(client, reply);
+        cJSON_Delete(reply);
     }
+
+    cJSON_Delete(root);
+    free(params.data);
+    free(url);
 }
 
 /**
- * Deletes the currently selected song from the playlist and adjusts the playlist size and capacity if necessary.
+ * Handles a command line received on the control socket. Server requests are made
+ * right away, and commands touching the player are queued for the UI thread.
  *
- * @param app_state A pointer to the AppState struct containing the current program state.
+ * @param server The control server.
+ * @param client The ID of the client.
+ * @param line   The command, a JSON object with a "command" member.
  */
-void delete_song(const AppState *const app_state)
+static void control_line(ControlServer *const server, const int client,
+                         const char *const line)
 {
-    Playlist *const playlist = app_state->playlist;
-    const int index = playlist->selected_song_idx;
-    const int playlist_size = playlist->size;
+    cJSON *const request = cJSON_Parse(line);
+    const char *const name = json_string_value(request, "command", NULL);
+    cJSON *song = NULL;
 
-    // If the selected song index is out of range, return without deleting any song.
-    if (index >= playlist_size || index < 0) {
+    if (name == NULL) {
+        control_result(client, "invalid command");
+        cJSON_Delete(request);
         return;
     }
-    // Stop playback when deleting the song that is currently being played
-    if (index == playlist->current_playing) {
-        stop_playback(app_state);
+    if (strcmp(name, "search") == 0) {
+        control_search(server, client, request);
+        cJSON_Delete(request);
+        return;
     }
-    // Use memmove to shift all elements after the deleted song one position to the left.
-    memmove(&playlist->songs[index], &playlist->songs[index + 1],
-            (playlist_size - index - 1) * sizeof(Song));
-
-    // Decrement the playlist size after deleting the song.
-    playlist->size--;
-
-    // If the playlist size is less than a quarter of its capacity and the capacity is greater than 10,
-    // reduce the capacity to half its current value using bit shifting instead of division.
-    if (playlist->capacity > 10 && playlist_size < playlist->capacity / 4) {
-        playlist->capacity >>= 1;       // Bit shift right by 1 to divide by 2.
-        playlist->songs =
-            realloc(playlist->songs,
-                    playlist->capacity * sizeof(Song));
-        // If realloc fails to allocate memory, print an error message and exit the program.
-        if (playlist->songs == NULL) {
-            fprintf(stderr,
-                    "Error: Failed to reallocate memory for playlist.\n");
-            exit(EXIT_FAILURE);
+
+    // Fetch the song to enqueue here, so the UI does not wait for the server
+    if (strcmp(name, "enqueue") == 0) {
+        char *url = NULL;
+        cJSON *root = NULL;
+
+        generate_subsonic_url(server->connection, SONG,
+                              json_string_value(request, "id", ""), &url);
+        song = cJSON_DetachItemFromObjectCaseSensitive(
+            request_subsonic(url, NULL, &root), "song");
+        cJSON_Delete(root);
+        free(url);
+
+        if (song == NULL) {
+            control_result(client, "unknown song");
+            cJSON_Delete(request);
+            return;
         }
     }
-    // If there are no more songs in the playlist, set the selected song index to -1.
-    if (playlist_size == 0) {
-        playlist->selected_song_idx = -1;
+
+    ControlCommand *const command = malloc(sizeof(ControlCommand));
+
+    if (command == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the command.\n");
+        exit(EXIT_FAILURE);
     }
-    // If the deleted song was the last one in the playlist, select the new last song.
-    else if (index + 1 == playlist_size) {
-        --(playlist->selected_song_idx);
+    *command = (ControlCommand) {
+        .client = client,
+        .request = request,
+        .song = song,
+        .next = NULL,
+    };
+
+    pthread_mutex_lock(&server->lock);
+    *server->last_command = command;
+    server->last_command = &command->next;
+    pthread_mutex_unlock(&server->lock);
+
+    if (write(server->wakeup[1], "", 1) < 0) {
+        // The pipe is full, so the UI thread is already due to wake up
     }
 }
 
 /**
- * Gets the process ID (PID) of the running instance of the specified program.
+ * Closes the connection of a client of the control socket.
  *
- * This function executes the "pidof" command to obtain the PID of the specified executable. It assumes that the
- * "pidof" command is available on the system and does not perform any error checking or validation.
+ * @param server The control server, locked by the caller.
+ * @param index  The index of the client.
+ */
+static void remove_client(ControlServer *const server, const int index)
+{
+    ControlClient *const client = &server->clients[index];
+
+    close(client->fd);
+    free(client->input.data);
+    free(client->output.data);
+    server->clients[index] = server->clients[--server->number_clients];
+}
+
+/**
+ * Reads the commands sent by a client of the control socket.
  *
- * @param program A Playback_Program struct containing the name of the program executable to look up.
- * @return The PID of the running instance of the program, or -1 if no such instance is found.
+ * @param server The control server.
+ * @param index  The index of the client.
+ * @return 0, or -1 if the client disconnected and was removed.
  */
-pid_t get_pid(const Playback_Program program)
+static int read_client(ControlServer *const server, const int index)
 {
-    char command[100];
+    char data[4096];
+    const ssize_t length = read(server->clients[index].fd, data, sizeof(data));
 
-    // Add cut because pthreads spawns a `sh` command which, in turn, starts program.executable
-    snprintf(command, sizeof(command), "pidof %s | cut -d \" \" -f 2",
-             program.executable);
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
 
-    FILE *const fp = popen(command, "r");
+    // Only the control thread changes the client list, so the client stays in place
+    // while its commands are handled
+    ControlClient *const client = &server->clients[index];
 
-    if (fp == NULL) {
-        perror("Error executing command");
-        return (pid_t) - 1;
+    if (length <= 0 || client->input.size + length > CONTROL_BUFFER_LIMIT) {
+        pthread_mutex_lock(&server->lock);
+        remove_client(server, index);
+        pthread_mutex_unlock(&server->lock);
+        return -1;
     }
-    // Read the output of the pidof command into a fixed-size buffer.
-    char pid_str[16];
 
-    if (fgets(pid_str, sizeof(pid_str), fp) == NULL) {
-        pclose(fp);
-        return (pid_t) - 1;
+    append_format(&client->input, "%.*s", (int) length, data);
+
+    char *start = client->input.data;
+    char *end;
+
+    while ((end = memchr(start, '\n', client->input.data + client->input.size - start))
+           != NULL) {
+        *end = '\0';
+        control_line(server, client->id, start);
+        start = end + 1;
     }
-    // Convert the PID string to an integer
-    pclose(fp);
-    return (pid_t) atoi(pid_str);
+    client->input.size -= start - client->input.data;
+    memmove(client->input.data, start, client->input.size + 1);
+    return 0;
 }
 
 /**
- * Changes the playback status of a running process by sending it a signal.
+ * Sends the messages queued for a client of the control socket.
  *
- * This function sends the specified signal to the process with the given PID, using the kill() system call.
+ * @param server The control server.
+ * @param index  The index of the client.
+ */
+static void write_client(ControlServer *const server, const int index)
+{
+    pthread_mutex_lock(&server->lock);
+
+    ControlClient *const client = &server->clients[index];
+    const ssize_t written = write(client->fd, client->output.data,
+                                  client->output.size);
+
+    if (written > 0) {
+        client->output.size -= written;
+        memmove(client->output.data, client->output.data + written,
+                client->output.size + 1);
+    } else if (written < 0 && errno != EAGAIN && errno != EINTR) {
+        client->output.size = 0;
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+/**
+ * Thread serving the control socket: accepts clients, reads their commands and
+ * sends them replies and events.
  *
- * @param pid The process ID of the running process.
- * @param signal The signal to send to the process.
+ * @param arg The control server.
+ * @return NULL.
  */
-void change_playback_status(const pid_t pid, const int signal)
+static void *control_thread(void *const arg)
 {
+    ControlServer *const server = arg;
+    struct pollfd *fds = NULL;
 
-    // If the PID is invalid or not set, there's nothing to do.
-    if (pid <= 0) {
-        return;
-    }
+    while (1) {
+        pthread_mutex_lock(&server->lock);
+        if (server->stopping) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
 
-    if (kill(pid, signal) == -1) {
-        // If the kill() call fails, log an error message.
-        perror("Error sending signal to process");
+        const int number_clients = server->number_clients;
+        struct pollfd *const p = realloc(fds, (number_clients + 2) * sizeof(struct pollfd));
+
+        if (p == NULL) {
+            fprintf(stderr, "Error: Failed to allocate memory for the control socket.\n");
+            exit(EXIT_FAILURE);
+        }
+        fds = p;
+        fds[0] = (struct pollfd) { .fd = server->listen_fd, .events = POLLIN };
+        fds[1] = (struct pollfd) { .fd = server->notify[0], .events = POLLIN };
+        for (int i = 0; i < number_clients; i++) {
+            fds[i + 2] = (struct pollfd) {
+                .fd = server->clients[i].fd,
+                .events = POLLIN | (server->clients[i].output.size > 0 ? POLLOUT : 0),
+            };
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (poll(fds, number_clients + 2, -1) < 0) {
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            char data[64];
+
+            while (read(server->notify[0], data, sizeof(data)) > 0) {
+            }
+        }
+
+        // Clients are removed by swapping in the last one, so walk them backwards
+        for (int i = number_clients - 1; i >= 0; i--) {
+            if (fds[i + 2].revents & POLLOUT) {
+                write_client(server, i);
+            }
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+                read_client(server, i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept4(server->listen_fd, NULL, NULL,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (fd >= 0) {
+                pthread_mutex_lock(&server->lock);
+
+                ControlClient *const c = realloc(server->clients,
+                                                 (server->number_clients + 1) *
+                                                 sizeof(ControlClient));
+
+                if (c == NULL) {
+                    fprintf(stderr, "Error: Failed to allocate memory for the control socket.\n");
+                    exit(EXIT_FAILURE);
+                }
+                server->clients = c;
+                server->clients[server->number_clients++] = (ControlClient) {
+                    .fd = fd,
+                    .id = server->next_client++,
+                };
+                pthread_mutex_unlock(&server->lock);
+            }
+        }
     }
+    free(fds);
+    return NULL;
 }
 
 /**
- * Dumps the current state of the application to a file.
- *
- * This function writes the current state of the application to a file. It includes
- * information about the currently playing song, its artist and album, and the time
- * at which the dump was created.
+ * Starts listening for commands on the control socket.
  *
- * @param app_state Pointer to the AppState object containing the current state
- *                  of the application.
+ * @param conn Connection struct containing information about the Subsonic server.
+ * @param name The socket name, resolved by runtime_path().
  */
-void dump(const AppState *const app_state)
+void start_control(const Connection *const conn, const char *const name)
 {
-    const time_t now = time(NULL);
-    const Playlist *const playlist = app_state->playlist;
-    const Song *song = playlist->songs[playlist->current_playing];
-    FILE *const fp = fopen(state_dump, "w");
+    ControlServer *const server = &control_server;
+    char *const path = runtime_path(name);
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
 
-    if (fp == NULL) {
-        printf("Error opening file!\n");
-        exit(1);
+    if (path == NULL || strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Invalid control socket path.\n");
+        free(path);
+        return;
     }
-    if (playlist->status != STOPPED) {
-        fprintf(fp, "{\"status\"   : \"%s\",\
-                      \"artist\"   : \"%s\",\
-                      \"album\"    : \"%s\",\
-                      \"song\"     : \"%s\",\
-                      \"length\"   : %d,\
-                      \"playtime\" : %d,\
-                      \"time\"     : %ld}\n", playlist->status == PLAYING ? "playing" : "paused", app_state->artist->name, app_state->album->name, song->name, song->duration, playlist->play_time, now);
-    } else {
-        fprintf(fp, "\n");
+    strcpy(address.sun_path, path);
+
+    // Take over a socket left by an instance that crashed, but not one still in use
+    const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const int in_use = probe >= 0
+        && connect(probe, (struct sockaddr *) &address, sizeof(address)) == 0;
+
+    if (probe >= 0) {
+        close(probe);
+    }
+    if (in_use) {
+        fprintf(stderr, "Error: Another instance listens on %s.\n", path);
+        free(path);
+        return;
+    }
+    unlink(path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0
+        || chmod(path, 0600) != 0 || listen(fd, 8) != 0
+        || pipe2(server->wakeup, O_NONBLOCK | O_CLOEXEC) != 0
+        || pipe2(server->notify, O_NONBLOCK | O_CLOEXEC) != 0) {
+        fprintf(stderr, "Error: Failed to open the control socket %s.\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(path);
+        return;
     }
-    fclose(fp);                 // close the file after writing
+
+    server->path = path;
+    server->listen_fd = fd;
+    server->connection = conn;
+    server->last_command = &server->commands;
+    server->started = pthread_create(&server->thread, NULL, &control_thread,
+                                     (void *) server) == 0;
 }
 
 /**
- * Notifies the user about the currently playing song.
- *
- * This function takes in a pointer to an AppState struct and generates a notification message with information about the currently playing song.
- * It then executes the notification using the system command. 
+ * Carries out a playback command received from outside, as if its key was pressed.
  *
- * @param app_state A pointer to an AppState struct containing information about the application's state.
+ * @param app_state Pointer to the AppState object.
+ * @param name      One of "play", "pause", "toggle", "stop", "next" and "previous".
+ * @return 0, or -1 if the command is unknown.
  */
-void notify(const AppState *const app_state)
+int playback_command(AppState *const app_state, const char *const name)
 {
-    char *const notification = calloc(NOTIFICATION_LENGTH, sizeof(char));
     const Playlist *const playlist = app_state->playlist;
-    const Song *const song = playlist->songs[playlist->current_playing];
 
-    if (notify_cmd != NULL) {
-        snprintf(notification, NOTIFICATION_LENGTH,
-                 "%s \"%s\" \"%s - %s - %s\"\n", notify_cmd,
-                 "Now playing", app_state->artist->name,
-                 app_state->album->name, song->name);
+    if (strcmp(name, "play") == 0) {
+        if (playlist->status == PAUSED) {
+            handle_action(play_pause, app_state);
+        } else if (playlist->status == STOPPED
+                   && playlist->current_playing < playlist->size) {
+            play_song(app_state, playlist->current_playing);
+        }
+    } else if (strcmp(name, "pause") == 0) {
+        if (playlist->status == PLAYING) {
+            handle_action(play_pause, app_state);
+        }
+    } else if (strcmp(name, "toggle") == 0) {
+        handle_action(play_pause, app_state);
+    } else if (strcmp(name, "stop") == 0) {
+        handle_action(stop, app_state);
+    } else if (strcmp(name, "next") == 0) {
+        handle_action(next, app_state);
+    } else if (strcmp(name, "previous") == 0) {
+        handle_action(previous, app_state);
+    } else {
+        return -1;
     }
-    system(notification);
-    free(notification);
+    return 0;
 }
 
 /**
- * Plays a song from the current playlist.
- * If defined, sends a notification and/or dumps the AppState into a file
- *
- * This function stops any currently-playing songs and starts playing the specified song. It generates a URL to stream the song,
- * executes the specified player program with appropriate flags, and updates the playlist state accordingly.
+ * Carries out the commands received on the control socket. Called by the UI thread
+ * when it is woken up through the wakeup pipe.
  *
- * @param app_state A pointer to the current application state.
- * @param index The index of the song in the playlist to play.
+ * @param app_state Pointer to the AppState object.
  */
-void play_song(const AppState *const app_state, const int index)
+void process_control_commands(AppState *const app_state)
 {
-    // Get references to the relevant data structures.
+    ControlServer *const server = &control_server;
     Playlist *const playlist = app_state->playlist;
-    const Playback_Program program = app_state->program;
+    char data[64];
 
-    // Validate the song index.
-    if (index >= playlist->size) {
-        fprintf(stderr, "Invalid song index.\n");
-        return;
+    while (read(server->wakeup[0], data, sizeof(data)) > 0) {
     }
-    // Send SIGTERM to the playlist process to stop any other playing processes.
-    change_playback_status(playlist->pid, SIGTERM);
-
-    // Set up playlist state for the new song.
-    const Song *const song = playlist->songs[index];
 
-    playlist->start_time = time(NULL);
-    playlist->current_playing = index;
-    playlist->status = PLAYING;
-    playlist->play_time = 0;
+    pthread_mutex_lock(&server->lock);
+    ControlCommand *command = server->commands;
 
-    // Generate URL to stream the song.
-    char *url = NULL;
+    server->commands = NULL;
+    server->last_command = &server->commands;
+    pthread_mutex_unlock(&server->lock);
 
-    generate_subsonic_url(app_state->connection, PLAY, song->id, &url);
+    while (command != NULL) {
+        ControlCommand *const following = command->next;
+        const char *const name = json_string_value(command->request, "command", "");
+        const char *error = NULL;
+        int replied = 0;
 
-    // Construct the command string to run the playback program.
-    const size_t command_len =
-        snprintf(NULL, 0, "%s %s \"%s\" > /dev/null 2>&1",
-                 program.executable,
-                 program.flags, url) + 1;
-    char command[command_len];
+        if (playback_command(app_state, name) == 0) {
+            // Nothing else to do
+        } else if (strcmp(name, "enqueue") == 0) {
+            Song *const song = intern_song(command->song);
 
-    snprintf(command, command_len, "%s %s \"%s\" > /dev/null 2>&1",
-             program.executable, program.flags, url);
+            add_song(song, playlist);
+            if (cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(command->request, "play"))) {
+                play_song(app_state, playlist->size - 1);
+            }
+            if (app_state->current_view == VIEW_PLAYLIST && app_state->viewed_playlist < 0) {
+                refresh_windows(app_state, app_state->windows[WINDOW_PLAYLIST], 1);
+            }
+        } else if (strcmp(name, "status") == 0 || strcmp(name, "subscribe") == 0) {
+            cJSON *const state = state_object(app_state);
+
+            if (strcmp(name, "subscribe") == 0) {
+                pthread_mutex_lock(&server->lock);
+                for (int i = 0; i < server->number_clients; i++) {
+                    if (server->clients[i].id == command->client) {
+                        server->clients[i].subscribed = 1;
+                    }
+                }
+                pthread_mutex_unlock(&server->lock);
+                cJSON_AddStringToObject(state, "event", "state");
+            } else {
+                cJSON_AddBoolToObject(state, "ok", 1);
+            }
+            // Status and subscriptions answer with the state itself
+            control_send(command->client, state);
+            cJSON_Delete(state);
+            replied = 1;
+        } else {
+            error = "unknown command";
+        }
 
-    // Set up arguments to pass to the playback thread.
-    PlaybackThreadArgs *const args = malloc(sizeof(PlaybackThreadArgs));
+        if (!replied) {
+            control_result(command->client, error);
+        }
+        cJSON_Delete(command->request);
+        cJSON_Delete(command->song);
+        free(command);
+        command = following;
+    }
+}
 
-    args->url = url;
-    args->command = command;
-    args->playlist_pid = playlist->pid;
+/**
+ * Stops the control socket server and removes its socket.
+ */
+void stop_control(void)
+{
+    ControlServer *const server = &control_server;
 
-    // Start the playback thread and detach it so that it runs independently.
-    pthread_t thread_id;
+    if (!server->started) {
+        return;
+    }
 
-    pthread_create(&thread_id, NULL, &playback_thread, (void *) args);
-    pthread_detach(thread_id);
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    pthread_mutex_unlock(&server->lock);
+    if (write(server->notify[1], "", 1) < 0) {
+        // The pipe is full, so the thread is already due to wake up
+    }
+    pthread_join(server->thread, NULL);
+    server->started = 0;
 
-    // Store the new process ID in the playlist state.
-    playlist->pid = get_pid(program);
-    if (notify_cmd != NULL) {
-        notify(app_state);
+    while (server->number_clients > 0) {
+        remove_client(server, server->number_clients - 1);
     }
-    if (state_dump != NULL) {
-        dump(app_state);
+    free(server->clients);
+    while (server->commands != NULL) {
+        ControlCommand *const command = server->commands;
+
+        server->commands = command->next;
+        cJSON_Delete(command->request);
+        cJSON_Delete(command->song);
+        free(command);
     }
+    close(server->listen_fd);
+    unlink(server->path);
+    free(server->path);
 }
 
 /**
- * Stops any currently-playing song in the playlist.
+ * Appends raw bytes to a growing buffer.
  *
- * This function sends a SIGTERM signal to the process ID associated with the current playlist, if one exists, and updates the
- * playlist state to indicate that playback has stopped.
+ * @param buffer The buffer to append to; its data may be NULL when empty.
+ * @param data   The bytes to append.
+ * @param size   The number of bytes.
+ */
+void append_bytes(struct url_data *const buffer, const void *const data,
+                  const int size)
+{
+    char *const p = realloc(buffer->data, buffer->size + size + 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+    buffer->data = p;
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    buffer->data[buffer->size] = '\0';
+}
+
+/* Marshalling of D-Bus values, in the byte order of the host. Values are aligned
+ * on their size relative to the start of the buffer, which holds a message body. */
+
+static char bus_byte_order(void)
+{
+    const uint16_t one = 1;
+
+    return *(const unsigned char *) &one ? 'l' : 'B';
+}
+
+static void bus_align(struct url_data *const buffer, const int alignment)
+{
+    static const char padding[8] = { 0 };
+
+    append_bytes(buffer, padding, (alignment - buffer->size % alignment) % alignment);
+}
+
+static void bus_byte(struct url_data *const buffer, const unsigned char value)
+{
+    append_bytes(buffer, &value, 1);
+}
+
+static void bus_uint32(struct url_data *const buffer, const uint32_t value)
+{
+    bus_align(buffer, 4);
+    append_bytes(buffer, &value, 4);
+}
+
+static void bus_int64(struct url_data *const buffer, const int64_t value)
+{
+    bus_align(buffer, 8);
+    append_bytes(buffer, &value, 8);
+}
+
+static void bus_double(struct url_data *const buffer, const double value)
+{
+    bus_align(buffer, 8);
+    append_bytes(buffer, &value, 8);
+}
+
+static void bus_string(struct url_data *const buffer, const char *const value)
+{
+    bus_uint32(buffer, strlen(value));
+    append_bytes(buffer, value, strlen(value) + 1);
+}
+
+static void bus_signature(struct url_data *const buffer, const char *const value)
+{
+    bus_byte(buffer, strlen(value));
+    append_bytes(buffer, value, strlen(value) + 1);
+}
+
+/**
+ * Starts an array; its elements follow and bus_close_array() completes it.
  *
- * @param app_state A pointer to the current application state.
+ * @param buffer    The buffer.
+ * @param alignment The alignment of the element type.
+ * @return The offset of the array length, to pass to bus_close_array().
  */
-void stop_playback(const AppState *const app_state)
+static int bus_open_array(struct url_data *const buffer, const int alignment)
 {
-    // Get a reference to the current playlist.
-    Playlist *const playlist = app_state->playlist;
+    bus_uint32(buffer, 0);
+
+    const int length = buffer->size - 4;
+
+    bus_align(buffer, alignment);
+    return length;
+}
+
+static void bus_close_array(struct url_data *const buffer, const int length,
+                            const int alignment)
+{
+    const int start = length + 4 + (alignment - (length + 4) % alignment) % alignment;
+    const uint32_t size = buffer->size - start;
+
+    memcpy(buffer->data + length, &size, 4);
+}
+
+/* Variants and dictionary entries of the a{sv} property maps */
+
+static void variant_string(struct url_data *const buffer, const char *const value)
+{
+    bus_signature(buffer, "s");
+    bus_string(buffer, value);
+}
+
+static void variant_boolean(struct url_data *const buffer, const int value)
+{
+    bus_signature(buffer, "b");
+    bus_uint32(buffer, value != 0);
+}
+
+static void variant_double(struct url_data *const buffer, const double value)
+{
+    bus_signature(buffer, "d");
+    bus_double(buffer, value);
+}
+
+static void variant_int64(struct url_data *const buffer, const int64_t value)
+{
+    bus_signature(buffer, "x");
+    bus_int64(buffer, value);
+}
+
+static void variant_strings(struct url_data *const buffer, const char *const value)
+{
+    bus_signature(buffer, "as");
+
+    const int length = bus_open_array(buffer, 4);
+
+    if (value != NULL) {
+        bus_string(buffer, value);
+    }
+    bus_close_array(buffer, length, 4);
+}
+
+static void dict_key(struct url_data *const buffer, const char *const key)
+{
+    bus_align(buffer, 8);
+    bus_string(buffer, key);
+}
+
+/* Reading of D-Bus messages, in the byte order they declare */
+
+typedef struct BusReader {
+    const unsigned char *data;
+    int size;
+    int offset;
+    int swap;                   /* The message byte order differs from the host */
+    int failed;                 /* Read past the end or met an unexpected type */
+} BusReader;
+
+static void read_align(BusReader *const reader, const int alignment)
+{
+    reader->offset += (alignment - reader->offset % alignment) % alignment;
+}
 
-    // Check if there is a current song playing.
-    if (playlist->status != STOPPED) {
-        // Stop the playback process and update playlist state.
-        change_playback_status(app_state->playlist->pid, SIGTERM);
-        app_state->playlist->status = STOPPED;
-        app_state->playlist->start_time = (time_t) NULL;
-        app_state->playlist->play_time = -1;
-    }
+static uint32_t read_uint32(BusReader *const reader)
+{
+    uint32_t value = 0;
 
-    if (state_dump != NULL) {
-        dump(app_state);
+    read_align(reader, 4);
+    if (reader->offset + 4 > reader->size) {
+        reader->failed = 1;
+        return 0;
     }
+    memcpy(&value, reader->data + reader->offset, 4);
+    reader->offset += 4;
+    return reader->swap ? __builtin_bswap32(value) : value;
 }
 
-/**
- * Pauses or resumes playback of a song in the playlist.
- *
- * If there is a current song playing, this function sends a SIGSTOP signal to pause playback, or a SIGCONT signal to resume playback,
- * depending on the current state of the playlist. It then updates the playlist state to reflect the new status.
- *
- * @param app_state A pointer to the current application state.
- */
-void pause_resume(const AppState *const app_state)
+static const char *read_string(BusReader *const reader)
 {
-    Playlist *const playlist = app_state->playlist;
+    const uint32_t length = read_uint32(reader);
 
-    // Check if there is a current song playing.
-    switch (playlist->status) {
-        case STOPPED:
-            // Do nothing if no song is playing.
-            break;
-        case PLAYING:
-            // Pause playback and update playlist state.
-            change_playback_status(playlist->pid, SIGSTOP);
-            playlist->status = PAUSED;
-            break;
-        case PAUSED:
-            // Resume playback and update playlist state.
-            const time_t now = time(NULL);
-            playlist->start_time = now;
-            change_playback_status(playlist->pid, SIGCONT);
-            playlist->status = PLAYING;
-            break;
+    if (reader->failed || length >= (uint32_t) (reader->size - reader->offset)) {
+        reader->failed = 1;
+        return "";
     }
 
-    if (state_dump != NULL) {
-        dump(app_state);
+    const char *const value = (const char *) reader->data + reader->offset;
+
+    reader->offset += length + 1;
+    return value;
+}
+
+static const char *read_signature(BusReader *const reader)
+{
+    if (reader->offset >= reader->size
+        || reader->data[reader->offset] >= reader->size - reader->offset - 1) {
+        reader->failed = 1;
+        return "";
     }
-    return;
+
+    const char *const value = (const char *) reader->data + reader->offset + 1;
+
+    reader->offset += reader->data[reader->offset] + 2;
+    return value;
 }
 
 /**
- * Callback function used to receive data from a libcurl request and write it to a buffer.
- *
- * This function is called by libcurl whenever new data is received in response to a URL request. It appends the new data to the existing
- * buffer pointed to by the `data` parameter, reallocating memory as necessary, and updates the size of the buffer accordingly.
+ * Reads a basic value wrapped in a variant, the only kind found in message headers
+ * and in the properties that can be set.
  *
- * @param ptr A pointer to the received data.
- * @param size The size of each data element.
- * @param nmemb The number of elements received.
- * @param data A pointer to a url_data struct containing information about the buffer being written to.
- * @return The total number of bytes written to the buffer.
+ * @param reader    The reader.
+ * @param signature Receives the type of the value.
+ * @param number    Receives the value of a boolean or integer.
+ * @return The value of a string, or an empty string.
  */
-int write_url_data(void *const ptr, const int size, const int nmemb,
-               struct url_data *const data)
+static const char *read_variant(BusReader *const reader, char *const signature,
+                                int64_t *const number)
 {
-    // Get the starting index and number of bytes to write.
-    const int start_index = data->size;
-    const int bytes_written = (size * nmemb);
+    const char *const type = read_signature(reader);
+
+    *signature = strlen(type) == 1 ? type[0] : '\0';
+    *number = 0;
+    switch (*signature) {
+        case 's':
+        case 'o':
+            return read_string(reader);
+        case 'g':
+            return read_signature(reader);
+        case 'b':
+        case 'u':
+        case 'i':
+            *number = read_uint32(reader);
+            return "";
+        case 'y':
+            if (reader->offset < reader->size) {
+                *number = reader->data[reader->offset++];
+            }
+            return "";
+        default:
+            reader->failed = 1;
+            return "";
+    }
+}
 
-    // Resize the data buffer to accommodate the new data.
-    char *const new_data_ptr = realloc(data->data, data->size + bytes_written + 1);   // +1 for '\0'
+/* Header fields of a received message */
+typedef struct BusMessage {
+    int type;
+    int flags;
+    uint32_t serial;
+    uint32_t reply_serial;
+    const char *path;
+    const char *interface;
+    const char *member;
+    const char *sender;
+    const char *signature;
+    BusReader body;
+} BusMessage;
 
-    if (new_data_ptr == NULL) {
-        fprintf(stderr, "Error: Failed to allocate memory for URL data.\n");
-        if (data->data) {
-            free(data->data);
-            data->data = NULL;
-            data->size = 0;
+enum { BUS_METHOD_CALL = 1, BUS_METHOD_RETURN, BUS_ERROR, BUS_SIGNAL };
+
+/**
+ * Sends a message on a bus connection.
+ *
+ * @param bus         The connection.
+ * @param type        The message type.
+ * @param path        The object path, or NULL.
+ * @param interface   The interface, or NULL.
+ * @param member      The method or signal name, or NULL.
+ * @param destination The bus name of the recipient, or NULL.
+ * @param error       The error name of an error reply, or NULL.
+ * @param reply_to    The serial of the call replied to, or 0.
+ * @param signature   The signature of the body.
+ * @param body        The marshalled body, or NULL if empty.
+ * @return The serial of the message, or 0 if it could not be sent.
+ */
+uint32_t bus_send(Bus *const bus, const int type, const char *const path,
+                  const char *const interface, const char *const member,
+                  const char *const destination, const char *const error,
+                  const uint32_t reply_to, const char *const signature,
+                  const struct url_data *const body)
+{
+    struct url_data message = { 0, NULL };
+    const uint32_t serial = ++bus->serial;
+
+    bus_byte(&message, bus_byte_order());
+    bus_byte(&message, type);
+    bus_byte(&message, 0);
+    bus_byte(&message, 1);
+    bus_uint32(&message, body != NULL ? body->size : 0);
+    bus_uint32(&message, serial);
+
+    // Header fields are (code, variant) structures
+    const char *const strings[] = { path, interface, member, error, destination };
+    static const unsigned char codes[] = { 1, 2, 3, 4, 6 };
+    const int length = bus_open_array(&message, 8);
+
+    for (int i = 0; i < 5; i++) {
+        if (strings[i] != NULL) {
+            bus_align(&message, 8);
+            bus_byte(&message, codes[i]);
+            bus_signature(&message, i == 0 ? "o" : "s");
+            bus_string(&message, strings[i]);
         }
-        return 0;
+    }
+    if (reply_to != 0) {
+        bus_align(&message, 8);
+        bus_byte(&message, 5);
+        bus_signature(&message, "u");
+        bus_uint32(&message, reply_to);
+    }
+    if (signature[0] != '\0') {
+        bus_align(&message, 8);
+        bus_byte(&message, 8);
+        bus_signature(&message, "g");
+        bus_signature(&message, signature);
+    }
+    bus_close_array(&message, length, 8);
+    bus_align(&message, 8);
+    if (body != NULL) {
+        append_bytes(&message, body->data, body->size);
     }
 
-    data->data = new_data_ptr;
-    memcpy((data->data + start_index), ptr, bytes_written);
-    data->size += bytes_written;
-    data->data[data->size] = '\0';
+    const int written = bus->fd >= 0 && write_buffer(bus->fd, &message) == 0;
 
-    return bytes_written;
+    free(message.data);
+    return written ? serial : 0;
 }
 
 /**
- * Generates a Subsonic API URL for a given operation and data.
- *
- * @param conn The connection settings to use for generating the URL.
- * @param operation The operation to perform.
- * @param data The data to include in the URL (optional).
- * @param url A pointer to a char pointer to store the generated URL.
+ * Parses the first complete message received on a bus connection.
  *
- * @return void
- * 
- * @note The memory for the generated URL is allocated dynamically and must be freed by the caller.
+ * @param bus     The connection.
+ * @param message Receives the message, pointing into the input buffer.
+ * @return The size of the message to drop once handled, 0 if it is not complete,
+ *         or -1 if the stream is corrupt.
  */
-void generate_subsonic_url(const Connection *const conn, enum Operation operation,
-                      const char *data, char **url)
+static int bus_parse(const Bus *const bus, BusMessage *const message)
 {
-    const char *path;
+    const unsigned char *const data = (const unsigned char *) bus->input.data;
+    const int size = bus->input.size;
 
-    // Set the path based on 'operation'
-    switch (operation) {
-        case PING:
-            path = "rest/ping.view";
-            break;
-        case ARTISTS:
-            path = "rest/getArtists";
-            break;
-        case ALBUMS:
-            path = "rest/getArtist";
-            break;
-        case SONGS:
-            path = "rest/getAlbum";
-            break;
-        case PLAY:
-            path = "rest/stream";
-            break;
-        default:
-            fprintf(stderr, "Invalid operation.\n");
-            return;
+    if (size < 16) {
+        return 0;
     }
 
-    const size_t len_url =
-        snprintf(NULL, 0, "%s:%d/%s?f=json&u=%s&p=%s&v=%s&c=%s%s%s",
-                 conn->url, conn->port, path, conn->user, conn->password,
-                 conn->version, conn->app, data ? "&id=" : "",
-                 data ? data : "");
+    BusReader header = {
+        .data = data,
+        .size = size,
+        .offset = 4,
+        .swap = data[0] != bus_byte_order(),
+    };
+    const uint32_t body_size = read_uint32(&header);
+
+    *message = (BusMessage) {
+        .type = data[1],
+        .flags = data[2],
+        .serial = read_uint32(&header),
+        .path = "",
+        .interface = NULL,
+        .member = "",
+        .sender = "",
+        .signature = "",
+    };
 
-    *url = malloc(sizeof(char) * (len_url + 1));
-    if (NULL == (*url)) {
-        fprintf(stderr, "Failed to allocate memory for the URL.\n");
-        return;
+    const uint32_t fields_size = read_uint32(&header);
+    const int64_t body_start = 16 + (int64_t) fields_size + (8 - fields_size % 8) % 8;
+
+    if (fields_size > (1 << 26) || body_size > (1 << 26)) {
+        return -1;
+    }
+    if (body_start + body_size > size) {
+        return 0;
     }
 
-    snprintf(*url, len_url + 1, "%s:%d/%s?f=json&u=%s&p=%s&v=%s&c=%s%s%s",
-             conn->url, conn->port, path, conn->user, conn->password,
-             conn->version, conn->app, data ? "&id=" : "", data ? data : "");
+    header.size = 16 + fields_size;
+    while (header.offset < header.size && !header.failed) {
+        read_align(&header, 8);
+
+        const int code = data[header.offset++];
+        char type;
+        int64_t number;
+        const char *const value = read_variant(&header, &type, &number);
+
+        switch (code) {
+            case 1: message->path = value; break;
+            case 2: message->interface = value; break;
+            case 3: message->member = value; break;
+            case 5: message->reply_serial = number; break;
+            case 7: message->sender = value; break;
+            case 8: message->signature = value; break;
+        }
+    }
+
+    message->body = (BusReader) {
+        .data = data + body_start,
+        .size = body_size,
+        .offset = 0,
+        .swap = header.swap,
+        .failed = header.failed,
+    };
+    return body_start + body_size;
 }
 
 /**
- * Fetches data from a given URL using libcurl and returns it as a string.
- *
- * @param url The URL to fetch data from.
+ * Connects to the session bus and authenticates as the current user.
+ * The Hello call that registers the connection is sent but not waited for.
  *
- * @return A pointer to the string containing the fetched data. This memory should be freed by the caller.
- *         If an error occurs, NULL is returned.
+ * @param bus The connection to open.
+ * @return 0 on success, -1 on failure.
  */
-char *fetch_url_data(const char *const url)
+int bus_connect(Bus *const bus)
 {
-    CURL *const curl_handle = curl_easy_init();
-    const int initial_size = 4096;
+    const char *const address = getenv("DBUS_SESSION_BUS_ADDRESS");
+    struct sockaddr_un socket_address = { .sun_family = AF_UNIX };
+    socklen_t length = 0;
 
-    struct url_data url_data = {
-        .size = 0,
-        .data = malloc(initial_size)
-    };
+    *bus = (Bus) { .fd = -1 };
 
-    if (url_data.data == NULL) {
-        fprintf(stderr, "Error: Failed to allocate memory.\n");
-        exit(EXIT_FAILURE);
-    }
+    // Use the first unix:path= or unix:abstract= address
+    for (const char *entry = address; entry != NULL && length == 0;
+         entry = strchr(entry, ';') ? strchr(entry, ';') + 1 : NULL) {
+        const int abstract = strncmp(entry, "unix:abstract=", 14) == 0;
 
-    url_data.data[0] = '\0';
+        if (!abstract && strncmp(entry, "unix:path=", 10) != 0) {
+            continue;
+        }
 
-    // If curl_handle failed, exit.
-    if (curl_handle == NULL) {
-        fprintf(stderr, "Error: Failed to initialize curl handle.\n");
-        exit(EXIT_FAILURE);
+        const char *const start = entry + (abstract ? 14 : 10);
+        const size_t size = strcspn(start, ",;");
+
+        if (size + 1 < sizeof(socket_address.sun_path)) {
+            memcpy(socket_address.sun_path + abstract, start, size);
+            length = offsetof(struct sockaddr_un, sun_path) + abstract + size;
+        }
+    }
+    if (length == 0) {
+        return -1;
     }
 
-    // Set curl options and perform request.
-    curl_easy_setopt(curl_handle, CURLOPT_URL, url);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_url_data);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &url_data);
-    curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2);
-    const CURLcode curl_result = curl_easy_perform(curl_handle);
+    bus->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
-    if (curl_result != CURLE_OK) {
-        fprintf(stderr, "curl_easy_perform() failed: %s\n",
-                curl_easy_strerror(curl_result));
-        free(url_data.data);
-        return NULL;
+    // A bus that does not answer must not hang the startup
+    const struct timeval timeout = { .tv_sec = 2 };
+    char uid[16];
+    char auth[64] = "AUTH EXTERNAL ";
+    char reply[256];
+    int received = 0;
+
+    // EXTERNAL authentication sends the user ID as hex-encoded decimal digits
+    snprintf(uid, sizeof(uid), "%u", (unsigned int) getuid());
+    for (const char *c = uid; *c; c++) {
+        snprintf(auth + strlen(auth), sizeof(auth) - strlen(auth), "%02x", *c);
     }
-    // Return fetched data and clean up.
-    curl_easy_cleanup(curl_handle);
-    return url_data.data;
+    strcat(auth, "\r\n");
+
+    if (bus->fd < 0
+        || setsockopt(bus->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+        || connect(bus->fd, (struct sockaddr *) &socket_address, length) != 0
+        || write(bus->fd, "", 1) != 1
+        || write(bus->fd, auth, strlen(auth)) != (ssize_t) strlen(auth)) {
+        bus_close(bus);
+        return -1;
+    }
+    while (received < (int) sizeof(reply) - 1
+           && (received < 2 || reply[received - 1] != '\n')
+           && read(bus->fd, reply + received, 1) == 1) {
+        received++;
+    }
+    reply[received] = '\0';
+    if (strncmp(reply, "OK ", 3) != 0 || write(bus->fd, "BEGIN\r\n", 7) != 7) {
+        bus_close(bus);
+        return -1;
+    }
+
+    bus_send(bus, BUS_METHOD_CALL, "/org/freedesktop/DBus", "org.freedesktop.DBus",
+             "Hello", "org.freedesktop.DBus", NULL, 0, "", NULL);
+    return 0;
 }
 
 /**
- * Fetches a list of artists from a Subsonic server using the provided connection information, populates a database structure
- * with the artist information, and stores the result in memory.
+ * Reads what is available on a bus connection into its input buffer.
  *
- * @param connection A pointer to a Connection struct that contains information about the Subsonic server.
- * @param db A pointer to a Database struct that will be populated with the list of artists.
- *
- * @return None.
- * 
- * @remarks The caller is responsible for freeing the memory allocated for the Database struct.
+ * @param bus The connection.
+ * @return 0, or -1 if the connection was closed.
  */
-void get_artists(const Connection *const connection, Database *const db)
+int bus_receive(Bus *const bus)
 {
-    // Generate the URL to fetch the artists data
-    char *url = NULL;
+    char data[4096];
+    const ssize_t length = read(bus->fd, data, sizeof(data));
 
-    generate_subsonic_url(connection, ARTISTS, NULL, &url);
-
-    char *const response = fetch_url_data(url);
-    cJSON *const response_root = cJSON_Parse(response);
-    cJSON const *subsonic_response =
-        cJSON_GetObjectItemCaseSensitive(response_root,
-                                         "subsonic-response");
-
-    if (strcmp
-        ("ok",
-         cJSON_GetObjectItemCaseSensitive(subsonic_response,
-                                          "status")->valuestring) != 0) {
-        fprintf(stderr,
-                "Error: Failed to retrieve artists from Subsonic server/\n");
-        exit(EXIT_FAILURE);
+    if (length == 0 || (length < 0 && errno != EAGAIN && errno != EINTR
+                        && errno != EWOULDBLOCK)) {
+        bus_close(bus);
+        return -1;
     }
+    if (length > 0) {
+        append_bytes(&bus->input, data, length);
+    }
+    return 0;
+}
 
-    int number_artists = 0;
-    const cJSON *const index =
-        cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive
-                                         (subsonic_response, "artists"),
-                                         "index");
-    const cJSON *alphabetical_index;
-
-    // Count the number of artists in the response
-    cJSON_ArrayForEach(alphabetical_index, index) {
-        const cJSON *const artists_list =
-            cJSON_GetObjectItemCaseSensitive(alphabetical_index,
-                                             "artist");
-        const cJSON *artist;
+/**
+ * Drops a handled message from the input buffer of a bus connection.
+ *
+ * @param bus  The connection.
+ * @param size The size of the message.
+ */
+static void bus_consume(Bus *const bus, const int size)
+{
+    bus->input.size -= size;
+    memmove(bus->input.data, bus->input.data + size, bus->input.size + 1);
+}
 
-        cJSON_ArrayForEach(artist, artists_list) {
-            number_artists++;
-        }
+/**
+ * Closes a bus connection.
+ *
+ * @param bus The connection.
+ */
+void bus_close(Bus *const bus)
+{
+    if (bus->fd >= 0) {
+        close(bus->fd);
     }
+    bus->fd = -1;
+    free(bus->input.data);
+    bus->input = (struct url_data) { 0, NULL };
+}
 
-    // Allocate memory for artists in the database
-    db->number_artists = number_artists;
-    db->artists = malloc(sizeof(Artist) * number_artists);
+static const char *const mpris_root_properties[] = {
+    "CanQuit", "CanRaise", "HasTrackList", "Identity", "SupportedUriSchemes",
+    "SupportedMimeTypes",
+};
+static const char *const mpris_player_properties[] = {
+    "PlaybackStatus", "LoopStatus", "Rate", "Shuffle", "Metadata", "Volume", "Position",
+    "MinimumRate", "MaximumRate", "CanGoNext", "CanGoPrevious", "CanPlay", "CanPause",
+    "CanSeek", "CanControl",
+};
 
-    // Loop through the artists in the response and store them in the database
-    int i = 0;
+/* Player properties that change with the playback state, sent in PropertiesChanged */
+static const char *const mpris_changing_properties[] = {
+    "PlaybackStatus", "LoopStatus", "Shuffle", "Metadata", "CanGoNext",
+    "CanGoPrevious", "CanPlay", "CanPause",
+};
 
-    cJSON_ArrayForEach(alphabetical_index, index) {
-        const cJSON *const artists_list =
-            cJSON_GetObjectItemCaseSensitive(alphabetical_index,
-                                             "artist");
-        const cJSON *artist;
+static const char *const mpris_introspection =
+    "<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\"\n"
+    " \"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n"
+    "<node>\n"
+    " <interface name=\"org.freedesktop.DBus.Introspectable\">\n"
+    "  <method name=\"Introspect\"><arg direction=\"out\" type=\"s\"/></method>\n"
+    " </interface>\n"
+    " <interface name=\"org.freedesktop.DBus.Properties\">\n"
+    "  <method name=\"Get\"><arg direction=\"in\" type=\"s\"/><arg direction=\"in\" type=\"s\"/>"
+    "<arg direction=\"out\" type=\"v\"/></method>\n"
+    "  <method name=\"GetAll\"><arg direction=\"in\" type=\"s\"/>"
+    "<arg direction=\"out\" type=\"a{sv}\"/></method>\n"
+    "  <method name=\"Set\"><arg direction=\"in\" type=\"s\"/><arg direction=\"in\" type=\"s\"/>"
+    "<arg direction=\"in\" type=\"v\"/></method>\n"
+    "  <signal name=\"PropertiesChanged\"><arg type=\"s\"/><arg type=\"a{sv}\"/>"
+    "<arg type=\"as\"/></signal>\n"
+    " </interface>\n"
+    " <interface name=\"" MPRIS_INTERFACE "\">\n"
+    "  <method name=\"Raise\"/><method name=\"Quit\"/>\n"
+    "  <property name=\"CanQuit\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanRaise\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"HasTrackList\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"Identity\" type=\"s\" access=\"read\"/>\n"
+    "  <property name=\"SupportedUriSchemes\" type=\"as\" access=\"read\"/>\n"
+    "  <property name=\"SupportedMimeTypes\" type=\"as\" access=\"read\"/>\n"
+    " </interface>\n"
+    " <interface name=\"" MPRIS_PLAYER_INTERFACE "\">\n"
+    "  <method name=\"Next\"/><method name=\"Previous\"/><method name=\"Pause\"/>\n"
+    "  <method name=\"PlayPause\"/><method name=\"Stop\"/><method name=\"Play\"/>\n"
+    "  <method name=\"Seek\"><arg direction=\"in\" type=\"x\"/></method>\n"
+    "  <method name=\"SetPosition\"><arg direction=\"in\" type=\"o\"/>"
+    "<arg direction=\"in\" type=\"x\"/></method>\n"
+    "  <method name=\"OpenUri\"><arg direction=\"in\" type=\"s\"/></method>\n"
+    "  <signal name=\"Seeked\"><arg type=\"x\"/></signal>\n"
+    "  <property name=\"PlaybackStatus\" type=\"s\" access=\"read\"/>\n"
+    "  <property name=\"LoopStatus\" type=\"s\" access=\"readwrite\"/>\n"
+    "  <property name=\"Rate\" type=\"d\" access=\"read\"/>\n"
+    "  <property name=\"Shuffle\" type=\"b\" access=\"readwrite\"/>\n"
+    "  <property name=\"Metadata\" type=\"a{sv}\" access=\"read\"/>\n"
+    "  <property name=\"Volume\" type=\"d\" access=\"read\"/>\n"
+    "  <property name=\"Position\" type=\"x\" access=\"read\"/>\n"
+    "  <property name=\"MinimumRate\" type=\"d\" access=\"read\"/>\n"
+    "  <property name=\"MaximumRate\" type=\"d\" access=\"read\"/>\n"
+    "  <property name=\"CanGoNext\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanGoPrevious\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanPlay\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanPause\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanSeek\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanControl\" type=\"b\" access=\"read\"/>\n"
+    " </interface>\n"
+    "</node>\n";
 
-        cJSON_ArrayForEach(artist, artists_list) {
-            Artist *const a = &(db->artists[i]);
-
-            a->id =
-                strdup(cJSON_GetObjectItemCaseSensitive(artist, "id")->
-                       valuestring);
-            a->name =
-                strdup(cJSON_GetObjectItemCaseSensitive(artist, "name")->
-                       valuestring);
-            a->number_albums = 0;
-            a->albums = NULL;
-            i++;
-        }
+/**
+ * Writes the Metadata property of the MPRIS player: the track ID, length, title,
+ * album and artist of the current song.
+ *
+ * @param buffer   The buffer.
+ * @param playlist The queue.
+ * @param song     The current song, or NULL if stopped.
+ */
+static void mpris_metadata(struct url_data *const buffer,
+                           const Playlist *const playlist, const Song *const song)
+{
+    char track[64];
+
+    // Object paths only allow a few characters, so the track ID uses the playlist node
+    snprintf(track, sizeof(track), "/org/sksonic/track/%d", playlist->playing_node);
+
+    bus_signature(buffer, "a{sv}");
+
+    const int length = bus_open_array(buffer, 8);
+
+    dict_key(buffer, "mpris:trackid");
+    bus_signature(buffer, "o");
+    bus_string(buffer, song != NULL ? track : "/org/mpris/MediaPlayer2/TrackList/NoTrack");
+    if (song != NULL) {
+        dict_key(buffer, "mpris:length");
+        variant_int64(buffer, (int64_t) song->duration * 1000000);
+        dict_key(buffer, "xesam:title");
+        variant_string(buffer, song->name);
+        dict_key(buffer, "xesam:album");
+        variant_string(buffer, song->album);
+        dict_key(buffer, "xesam:artist");
+        variant_strings(buffer, song->artist);
     }
-
-    // Clean up
-    cJSON_Delete(response_root);
-    free(url);
-    free(response);
+    bus_close_array(buffer, length, 8);
 }
 
 /**
- * Finds an artist in the database based on the artist ID.
- *
- * @param db The database to search.
- * @param artist_id The ID of the artist to find.
+ * Writes the value of an MPRIS property as a variant.
  *
- * @return The index of the artist in the database, or -1 if not found.
+ * @param buffer    The buffer.
+ * @param app_state Pointer to the AppState object.
+ * @param name      The property name.
+ * @return 0, or -1 if the property is unknown.
  */
-int find_artist(const Database *const db, const char *const artist_id)
+static int mpris_property(struct url_data *const buffer,
+                          const AppState *const app_state, const char *const name)
 {
-    // Check if the artist is already in the database
-    for (int i = 0; i < db->number_artists; i++) {
-        const Artist *const artist = &db->artists[i];
-
-        if (strcmp(artist->id, artist_id) == 0) {
-            // Artist is already in the database, return the album list
-            return i;
-        }
+    const Playlist *const playlist = app_state->playlist;
+    const Song *const song = playlist->status != STOPPED ?
+        playlist_song(playlist, playlist->current_playing) : NULL;
+
+    if (strcmp(name, "PlaybackStatus") == 0) {
+        variant_string(buffer, playlist->status == PLAYING ? "Playing" :
+                       playlist->status == PAUSED ? "Paused" : "Stopped");
+    } else if (strcmp(name, "LoopStatus") == 0) {
+        // Repeat mode plays the current song again
+        variant_string(buffer, playlist->shuffle_repeat_status == REPEAT ? "Track" : "None");
+    } else if (strcmp(name, "Shuffle") == 0) {
+        variant_boolean(buffer, playlist->shuffle_repeat_status == SHUFFLE);
+    } else if (strcmp(name, "Metadata") == 0) {
+        mpris_metadata(buffer, playlist, song);
+    } else if (strcmp(name, "Position") == 0) {
+        variant_int64(buffer, song != NULL ? (int64_t) MAX(playlist->play_time, 0) * 1000000 : 0);
+    } else if (strcmp(name, "Rate") == 0 || strcmp(name, "MinimumRate") == 0
+               || strcmp(name, "MaximumRate") == 0 || strcmp(name, "Volume") == 0) {
+        variant_double(buffer, 1.0);
+    } else if (strcmp(name, "CanGoNext") == 0) {
+        variant_boolean(buffer, playlist->current_playing < playlist->size - 1
+                        || (playlist->shuffle_repeat_status == SHUFFLE && playlist->size > 0));
+    } else if (strcmp(name, "CanGoPrevious") == 0) {
+        variant_boolean(buffer, playlist->current_playing > 0);
+    } else if (strcmp(name, "CanPlay") == 0) {
+        variant_boolean(buffer, playlist->size > 0);
+    } else if (strcmp(name, "CanPause") == 0) {
+        variant_boolean(buffer, song != NULL);
+    } else if (strcmp(name, "CanControl") == 0) {
+        variant_boolean(buffer, 1);
+    } else if (strcmp(name, "CanSeek") == 0 || strcmp(name, "CanQuit") == 0
+               || strcmp(name, "CanRaise") == 0 || strcmp(name, "HasTrackList") == 0) {
+        variant_boolean(buffer, 0);
+    } else if (strcmp(name, "Identity") == 0) {
+        variant_string(buffer, "sksonic");
+    } else if (strcmp(name, "SupportedUriSchemes") == 0
+               || strcmp(name, "SupportedMimeTypes") == 0) {
+        variant_strings(buffer, NULL);
+    } else {
+        return -1;
     }
-    return -1;
+    return 0;
 }
 
 /**
- * Finds an album in the given artist's album list with the given ID.
- *
- * @param artist   The artist to search for the album in.
- * @param album_id The ID of the album to search for.
+ * Writes a map of MPRIS properties to their values.
  *
- * @return The index of the album in the artist's album list, or -1 if the album was not found.
+ * @param buffer    The buffer.
+ * @param app_state Pointer to the AppState object.
+ * @param names     The property names.
+ * @param count     The number of properties.
  */
-int find_album(const Artist *const artist, const char *const album_id)
+static void mpris_properties(struct url_data *const buffer,
+                             const AppState *const app_state,
+                             const char *const *const names, const int count)
 {
-    // Check if the artist is already in the database
-    for (int i = 0; i < artist->number_albums; i++) {
-        const Album *const album = &artist->albums[i];
+    const int length = bus_open_array(buffer, 8);
 
-        if (strcmp(album->id, album_id) == 0) {
-            // Album is already in the database, return its index
-            return i;
-        }
+    for (int i = 0; i < count; i++) {
+        dict_key(buffer, names[i]);
+        mpris_property(buffer, app_state, names[i]);
     }
-    return -1;
+    bus_close_array(buffer, length, 8);
 }
 
 /**
- * Retrieves albums for an artist from a Subsonic server and stores them in the provided Artist struct.
+ * Sends the PropertiesChanged signal of the MPRIS player after a change of the playback state.
  *
- * @param conn   Connection struct containing information about the Subsonic server
- * @param artist Artist struct to store the retrieved albums in
+ * @param app_state Pointer to the AppState object.
  */
-void request_albums(const Connection *const conn, Artist *const artist)
+void mpris_changed(const AppState *const app_state)
 {
-    if (artist->albums != NULL) {
-        // If album information for this artist has already been retrieved, return
+    struct url_data body = { 0, NULL };
+
+    if (session_bus.fd < 0) {
         return;
     }
 
-    char *url = NULL;
+    bus_string(&body, MPRIS_PLAYER_INTERFACE);
+    mpris_properties(&body, app_state, mpris_changing_properties,
+                     sizeof(mpris_changing_properties) / sizeof(mpris_changing_properties[0]));
 
-    generate_subsonic_url(conn, ALBUMS, artist->id, &url);
+    // No invalidated properties
+    bus_close_array(&body, bus_open_array(&body, 4), 4);
 
-    char *const response = fetch_url_data(url);
-    cJSON *const response_root = cJSON_Parse(response);
-    cJSON *const subsonic_response =
-        cJSON_GetObjectItemCaseSensitive(response_root,
-                                         "subsonic-response");
+    bus_send(&session_bus, BUS_SIGNAL, MPRIS_PATH, "org.freedesktop.DBus.Properties",
+             "PropertiesChanged", NULL, NULL, 0, "sa{sv}as", &body);
+    free(body.data);
+}
 
-    if (strcmp
-        ("ok",
-         cJSON_GetObjectItemCaseSensitive(subsonic_response,
-                                          "status")->valuestring) != 0) {
-        fprintf(stderr,
-                "Error: Failed to retrieve artists from Subsonic server/\n");
-        exit(EXIT_FAILURE);
-    }
+/**
+ * Handles a method call on the MPRIS object and replies to it.
+ *
+ * @param app_state Pointer to the AppState object.
+ * @param message   The method call.
+ */
+static void mpris_call(AppState *const app_state, const BusMessage *const message)
+{
+    Playlist *const playlist = app_state->playlist;
+    const char *const member = message->member;
+    BusReader args = message->body;
+    struct url_data body = { 0, NULL };
+    const char *signature = "";
+    const char *error = NULL;
+
+    // Playback methods map to the keys with the same effect
+    static const char *const methods[][2] = {
+        { "Play", "play" }, { "Pause", "pause" }, { "PlayPause", "toggle" },
+        { "Stop", "stop" }, { "Next", "next" }, { "Previous", "previous" },
+    };
+    const char *command = NULL;
 
-    const cJSON *const artist_json =
-        cJSON_GetObjectItemCaseSensitive(subsonic_response, "artist");
-    const int number_albums = cJSON_GetObjectItemCaseSensitive(artist_json,
-                                                       "albumCount")->valueint;
-    if (number_albums == 0) {
-        return;                 // No albums found for this artist
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (strcmp(member, methods[i][0]) == 0) {
+            command = methods[i][1];
+        }
     }
 
-    artist->albums = malloc(sizeof(Album) * number_albums);
-    artist->number_albums = number_albums;
-    const cJSON *const albums =
-        cJSON_GetObjectItemCaseSensitive(artist_json, "album");
-    const cJSON *album;
-    int i = 0;
-
-    cJSON_ArrayForEach(album, albums) {
-        Album *const a = &(artist->albums[i]);
-
-        a->id =
-            strdup(cJSON_GetObjectItemCaseSensitive(album, "id")->valuestring);
-        a->name =
-            strdup(cJSON_GetObjectItemCaseSensitive(album, "name")->
-                   valuestring);
-        a->number_songs = 0;
-        a->songs = NULL;
-        i++;
+    if (strcmp(message->path, MPRIS_PATH) != 0) {
+        error = "org.freedesktop.DBus.Error.UnknownObject";
+    } else if (strcmp(member, "Introspect") == 0) {
+        signature = "s";
+        bus_string(&body, mpris_introspection);
+    } else if (strcmp(member, "Get") == 0 || strcmp(member, "Set") == 0) {
+        const char *const interface = read_string(&args);
+        const char *const name = read_string(&args);
+        const int known = mpris_property(&body, app_state, name) == 0
+            && (strcmp(interface, MPRIS_INTERFACE) == 0
+                || strcmp(interface, MPRIS_PLAYER_INTERFACE) == 0);
+
+        if (args.failed || !known) {
+            error = "org.freedesktop.DBus.Error.UnknownProperty";
+        } else if (strcmp(member, "Get") == 0) {
+            signature = "v";
+        } else if (strcmp(name, "LoopStatus") == 0 || strcmp(name, "Shuffle") == 0) {
+            char type;
+            int64_t number;
+            const char *const value = read_variant(&args, &type, &number);
+            const int enable = strcmp(name, "Shuffle") == 0 ? number != 0
+                : strcmp(value, "None") != 0;
+            const ShuffleRepeatStatus status = strcmp(name, "Shuffle") == 0 ? SHUFFLE : REPEAT;
+
+            if (enable != (playlist->shuffle_repeat_status == status)) {
+                handle_action(status == SHUFFLE ? shuffle : repeat, app_state);
+            }
+        } else {
+            error = "org.freedesktop.DBus.Error.PropertyReadOnly";
+        }
+        if (strcmp(member, "Set") == 0 || error != NULL) {
+            body.size = 0;
+        }
+    } else if (strcmp(member, "GetAll") == 0) {
+        const char *const interface = read_string(&args);
+
+        signature = "a{sv}";
+        if (strcmp(interface, MPRIS_PLAYER_INTERFACE) == 0) {
+            mpris_properties(&body, app_state, mpris_player_properties,
+                             sizeof(mpris_player_properties) / sizeof(mpris_player_properties[0]));
+        } else if (strcmp(interface, MPRIS_INTERFACE) == 0) {
+            mpris_properties(&body, app_state, mpris_root_properties,
+                             sizeof(mpris_root_properties) / sizeof(mpris_root_properties[0]));
+        } else {
+            mpris_properties(&body, app_state, NULL, 0);
+        }
+    } else if (command != NULL) {
+        playback_command(app_state, command);
+    } else if (strcmp(member, "Ping") != 0 && strcmp(member, "Raise") != 0
+               && strcmp(member, "Quit") != 0 && strcmp(member, "Seek") != 0
+               && strcmp(member, "SetPosition") != 0 && strcmp(member, "OpenUri") != 0) {
+        // The other methods are accepted but do nothing, as the Can* properties announce
+        error = "org.freedesktop.DBus.Error.UnknownMethod";
     }
 
-    cJSON_Delete(response_root);
-    free(url);
-    free(response);
+    // Bit 0 of the flags is NO_REPLY_EXPECTED
+    if (!(message->flags & 1)) {
+        if (error != NULL) {
+            body.size = 0;
+            bus_string(&body, member);
+            bus_send(&session_bus, BUS_ERROR, NULL, NULL, NULL, message->sender, error,
+                     message->serial, "s", &body);
+        } else {
+            bus_send(&session_bus, BUS_METHOD_RETURN, NULL, NULL, NULL, message->sender,
+                     NULL, message->serial, signature, &body);
+        }
+    }
+    free(body.data);
 }
 
 /**
- * Retrieves album information for a given artist from the server.
+ * Asks the bus for the MPRIS name of the player.
  *
- * This function retrieves album information for a given artist from the server
- * by sending a request over the provided connection. If the artist already has
- * album information in the database, the function does nothing.
- *
- * @param conn      Pointer to the Connection object used to send requests to the server.
- * @param db        Pointer to the Database object containing the artist and album information.
- * @param artist_id The ID of the artist for which to retrieve album information.
+ * @param name The well-known name.
  */
-void get_albums(const Connection *const conn, const Database *const db, 
-        const char *const artist_id)
+static void mpris_request_name(const char *const name)
 {
-    // Retrieve the position occupied by the artist in the database
-    const int artist_idx = find_artist(db, artist_id);
-
-    Artist *const artist = &(db->artists[artist_idx]);
+    struct url_data body = { 0, NULL };
+
+    bus_string(&body, name);
+    bus_uint32(&body, 4);       /* DBUS_NAME_FLAG_DO_NOT_QUEUE */
+    session_bus.name_serial =
+        bus_send(&session_bus, BUS_METHOD_CALL, "/org/freedesktop/DBus",
+                 "org.freedesktop.DBus", "RequestName", "org.freedesktop.DBus", NULL,
+                 0, "su", &body);
+    free(body.data);
+}
 
-    // Check if the artist already has album information
-    if (artist->number_albums == 0) {
-        request_albums(conn, artist);
+/**
+ * Connects to the session bus and exposes the player as org.mpris.MediaPlayer2.sksonic.
+ */
+void start_mpris(void)
+{
+    // No session bus, as on a console without a desktop session
+    if (getenv("DBUS_SESSION_BUS_ADDRESS") == NULL) {
+        return;
     }
+    if (bus_connect(&session_bus) != 0) {
+        fprintf(stderr, "Error: Failed to connect to the session bus.\n");
+        return;
+    }
+    mpris_request_name("org.mpris.MediaPlayer2.sksonic");
 }
 
 /**
- * Retrieves song information for a given album by an artist from the server.
- *
- * This function retrieves song information for a given album by an artist from the
- * server by sending a request over the provided connection. If the album already has
- * song information in the database, the function does nothing.
+ * Handles the messages received on the session bus. Called by the UI thread when the
+ * connection is readable.
  *
- * @param conn      Pointer to the Connection object used to send requests to the server.
- * @param db        Pointer to the Database object containing the artist and album information.
- * @param artist_id The ID of the artist for which to retrieve album information.
- * @param album_id  The ID of the album for which to retrieve song information.
+ * @param app_state Pointer to the AppState object.
  */
-void get_songs(const Connection *const conn, const Database *const db, 
-        const char *const artist_id, const char *const album_id)
+void process_bus(AppState *const app_state)
 {
-    // Retrieve the position occupied by the artist in the database
-    const int artist_idx = find_artist(db, artist_id);
-    const Artist *const artist = &(db->artists[artist_idx]);
+    Bus *const bus = &session_bus;
+    BusMessage message;
+    int size;
 
-    // Retrieve the position occupied by the album in the Artist struct 
-    const int album_idx = find_album(artist, album_id);
-    Album *const album = &(artist->albums[album_idx]);
+    if (bus_receive(bus) != 0) {
+        return;
+    }
 
-    // Check if the album already has song information
-    if (album->number_songs == 0) {
-        request_songs(conn, album);
+    while ((size = bus_parse(bus, &message)) > 0) {
+        if (message.type == BUS_METHOD_CALL && !message.body.failed) {
+            mpris_call(app_state, &message);
+        } else if (message.reply_serial != 0 && message.reply_serial == bus->name_serial) {
+            BusReader reply = message.body;
+            const uint32_t result = message.type == BUS_METHOD_RETURN ? read_uint32(&reply) : 0;
+
+            // Another player owns the name: use an instance name, as the specification allows
+            bus->name_serial = 0;
+            if (result != 1 && result != 4) {
+                char name[64];
+
+                snprintf(name, sizeof(name), "org.mpris.MediaPlayer2.sksonic.instance%d",
+                         (int) getpid());
+                mpris_request_name(name);
+            }
+        }
+        bus_consume(bus, size);
+    }
+    if (size < 0) {
+        bus_close(bus);
     }
 }
 
 /**
- * Calculates the approximate duration of a song based on its size and bit rate.
- *
- * This function calculates the approximate duration of a song based on its size and
- * bit rate. It uses the formula: size*8/rate/1000 to compute the duration in seconds.
- *
- * @param song A JSON object representing the song to compute the duration for.
- *             The object must have "size" and "bitRate" fields containing the size
- *             of the song in bytes and its bit rate in kilobits per second (kbps),
- *             respectively.
+ * Appends a string to a buffer, escaping the characters that the body markup of
+ * desktop notifications interprets.
  *
- * @return The approximate duration of the song in seconds.
+ * @param buffer The buffer.
+ * @param text   The plain text.
  */
-int approximate_duration(const cJSON *const song)
+static void append_markup(struct url_data *const buffer, const char *const text)
 {
-    const int size = cJSON_GetObjectItemCaseSensitive(song, "size")->valueint;
-    const int rate =
-        cJSON_GetObjectItemCaseSensitive(song, "bitRate")->valueint;
-    return size * 8 / rate / 1000;
+    for (const char *c = text; *c; c++) {
+        switch (*c) {
+            case '&': append_format(buffer, "&amp;"); break;
+            case '<': append_format(buffer, "&lt;"); break;
+            case '>': append_format(buffer, "&gt;"); break;
+            default: append_bytes(buffer, c, 1); break;
+        }
+    }
 }
 
 /**
- * Retrieves song information for a given album from the Subsonic server.
+ * Shows a notification through the org.freedesktop.Notifications service and waits
+ * for its ID, so the next notification can replace it.
  *
- * This function retrieves song information for a given album by sending a request to
- * the Subsonic server over the provided connection. The retrieved information is stored
- * in the provided Album object. If the album already has song information, the function
- * does nothing.
+ * @param bus         The session bus connection, closed if it fails.
+ * @param replaces_id The ID of the notification to replace, 0 if none. Receives the
+ *                    ID of the new one.
+ * @param summary     The summary.
+ * @param text        The body, as plain text.
+ * @return 0 on success, -1 if there is no notification service or the bus failed.
+ */
+static int send_notification(Bus *const bus, uint32_t *const replaces_id,
+                             const char *const summary, const char *const text)
+{
+    struct url_data body = { 0, NULL };
+    struct url_data markup = { 0, NULL };
+
+    append_markup(&markup, text);
+    bus_string(&body, "sksonic");
+    bus_uint32(&body, *replaces_id);
+    bus_string(&body, "");                              /* app_icon */
+    bus_string(&body, summary);
+    bus_string(&body, markup.data);
+    bus_close_array(&body, bus_open_array(&body, 4), 4);    /* actions */
+    bus_close_array(&body, bus_open_array(&body, 8), 8);    /* hints */
+    bus_uint32(&body, (uint32_t) -1);                   /* expire_timeout: server default */
+
+    const uint32_t serial =
+        bus_send(bus, BUS_METHOD_CALL, "/org/freedesktop/Notifications",
+                 "org.freedesktop.Notifications", "Notify",
+                 "org.freedesktop.Notifications", NULL, 0, "susssasa{sv}i", &body);
+
+    free(body.data);
+    free(markup.data);
+
+    // Skip the Hello reply and signals until the reply to the call
+    struct pollfd fd = { .fd = bus->fd, .events = POLLIN };
+
+    while (serial != 0) {
+        BusMessage message;
+        int size;
+
+        while ((size = bus_parse(bus, &message)) > 0) {
+            if (message.reply_serial == serial) {
+                BusReader reply = message.body;
+                const int status = message.type == BUS_METHOD_RETURN ? 0 : -1;
+
+                if (status == 0) {
+                    *replaces_id = read_uint32(&reply);
+                }
+                bus_consume(bus, size);
+                return status;
+            }
+            bus_consume(bus, size);
+        }
+        if (size < 0 || poll(&fd, 1, 2000) <= 0 || bus_receive(bus) != 0) {
+            break;
+        }
+    }
+    bus_close(bus);
+    return -1;
+}
+
+/**
+ * Runs notify_cmd, if set, with the summary and the body as its last two arguments.
+ * The command is split on spaces and run without a shell, so song titles are passed
+ * verbatim.
  *
- * @param conn  Pointer to the Connection object used to send requests to the server.
- * @param album Pointer to the Album object to store the retrieved song information.
+ * @param summary The summary.
+ * @param text    The body.
  */
-void request_songs(const Connection *const conn, Album *const album)
+static void run_notify_cmd(const char *const summary, const char *const text)
 {
-    if (album->songs != NULL) {
-        // If album information for this artist has already been retrieved, return
+    if (notify_cmd == NULL) {
         return;
     }
 
-    char *url = NULL;
-
-    generate_subsonic_url(conn, SONGS, album->id, &url);
+    struct url_data command = { 0, NULL };
+    char *arguments[32];
+    int count = 0;
 
-    char *const response = fetch_url_data(url);
-    cJSON *const response_root = cJSON_Parse(response);
-    cJSON *const subsonic_response = 
-        cJSON_GetObjectItemCaseSensitive(response_root, "subsonic-response");
+    append_format(&command, "%s", notify_cmd);
 
-    if (strcmp("ok", cJSON_GetObjectItemCaseSensitive(subsonic_response,
-                                          "status")->valuestring) != 0) {
-        fprintf(stderr,
-                "Error: Failed to retrieve artists from Subsonic server/\n");
-        exit(EXIT_FAILURE);
+    // Build the arguments before forking, only exec is safe in the child of a thread
+    for (char *argument = strtok(command.data, " "); argument != NULL && count < 29;
+         argument = strtok(NULL, " ")) {
+        arguments[count++] = argument;
     }
-
-    const cJSON *const album_json =
-        cJSON_GetObjectItemCaseSensitive(subsonic_response, "album");
-    const int number_songs =
-        cJSON_GetObjectItemCaseSensitive(album_json, "songCount")->valueint;
-
-    album->songs = malloc(sizeof(Song) * number_songs);
-    album->number_songs = number_songs;
-    const cJSON *const songs = cJSON_GetObjectItemCaseSensitive(album_json, "song");
-    const cJSON *song;
-    int i = 0;
-
-    cJSON_ArrayForEach(song, songs) {
-        Song *const s = &(album->songs[i]);
-
-        s->id =
-            strdup(cJSON_GetObjectItemCaseSensitive(song, "id")->valuestring);
-        s->name =
-            strdup(cJSON_GetObjectItemCaseSensitive(song, "title")->
-                   valuestring);
-        s->duration = cJSON_HasObjectItem(song, "duration") ? 
-            cJSON_GetObjectItemCaseSensitive(song, "duration")->valueint :
-            approximate_duration(song);
-        i++;
+    arguments[count++] = (char *) summary;
+    arguments[count++] = (char *) text;
+    arguments[count] = NULL;
+
+    const int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+    const pid_t pid = fork();
+
+    if (pid == 0) {
+        // Keep the output of the command off the screen
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execvp(arguments[0], arguments);
+        _exit(127);
     }
-
-    cJSON_Delete(response_root);
-    free(url);
-    free(response);
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+    if (null >= 0) {
+        close(null);
+    }
+    free(command.data);
 }
 
 /**
- * Plays the previous or next song in the playlist.
- *
- * This function plays the previous or next song in the playlist depending on the
- * action provided. If the current song is the first/last one in the playlist and
- * the user triggers a "previous"/"next" action, the function does nothing.
+ * Thread that shows the notifications queued by notify(). Only the latest one is kept,
+ * and each one replaces the previous bubble instead of stacking a new one.
+ * Falls back to notify_cmd when no notification service answers on the session bus.
  *
- * @param app_state Pointer to the AppState object containing the current state
- *                  of the application.
- * @param action    An integer constant representing the action to perform. It can take
- *                  one of two values: `previous` (to play the previous song) or `next`
- *                  (to play the next song).
+ * @param arg Unused.
+ * @return NULL.
  */
-void play_previous_next(AppState *const app_state, const int action)
+void *notifier_thread(void *const arg)
 {
-    Playlist *const playlist = app_state->playlist;
+    Notifier *const notifier = &desktop_notifier;
+    Bus bus = { .fd = -1 };
+    uint32_t replaces_id = 0;
 
-    switch (action) {
-        case previous:
-            if (playlist->current_playing > 0) {
-                --(playlist->current_playing);
-                play_song(app_state, playlist->current_playing);
-            }
-            break;
-        case next:
-            if (playlist->current_playing < playlist->size - 1) {
-                ++(playlist->current_playing);
-                play_song(app_state, playlist->current_playing);
-            }
-            break;
-        default:
+    pthread_mutex_lock(&notifier->lock);
+    while (1) {
+        while (!notifier->stopping && notifier->summary == NULL) {
+            pthread_cond_wait(&notifier->cond, &notifier->lock);
+        }
+        if (notifier->stopping) {
             break;
+        }
+
+        char *const summary = notifier->summary;
+        char *const text = notifier->text;
+
+        notifier->summary = NULL;
+        notifier->text = NULL;
+        pthread_mutex_unlock(&notifier->lock);
+
+        const int shown = desktop_notifications
+            && (bus.fd >= 0 || bus_connect(&bus) == 0)
+            && send_notification(&bus, &replaces_id, summary, text) == 0;
+
+        if (!shown) {
+            run_notify_cmd(summary, text);
+        }
+        free(summary);
+        free(text);
+
+        pthread_mutex_lock(&notifier->lock);
     }
+    pthread_mutex_unlock(&notifier->lock);
+    bus_close(&bus);
+    return NULL;
 }
 
 /**
- * Adds songs to the playlist based on the current panel of the application.
- *
- * This function adds songs to the playlist based on the current panel of the
- * application. If the current panel is the "Artists" panel, it adds all songs from all
- * albums of the currently selected artist. If the current panel is the "Albums" panel,
- * it adds all songs from the currently selected album. If the current panel is the
- * "Songs" panel, it adds the currently selected song to the playlist.
- *
- * @param app_state Pointer to the AppState object containing the current state of the
- *                  application.
- *
- * @return The index of the first song that was added to the playlist (0-indexed), or 0 if
- *         no songs were added to the playlist.
+ * Stops the notifier thread, dropping a notification that was not shown yet.
  */
-int add_to_playlist(AppState *app_state)
+void stop_notifier(void)
 {
-    Playlist *const playlist = app_state->playlist;
-    const Artist *const artist = app_state->artist;
-    const Album *album = app_state->album;
-    const Song *song = NULL;
-    const int first_song_to_play = playlist->size;
-    const int has_songs = playlist->size == 0 ? 0 : 1;
-    const PanelType current_panel = app_state->current_panel;
+    Notifier *const notifier = &desktop_notifier;
 
-    switch (current_panel) {
-        case PANEL_ARTISTS:
-            for (int i = 0; i < artist->number_albums; ++i) {
-                album = &artist->albums[i];
-                get_songs(app_state->connection, app_state->db, artist->id,
-                          album->id);
-                for (int j = 0; j < album->number_songs; ++j) {
-                    song = &album->songs[j];
-                    add_song(song, playlist);
-                }
-            }
-            break;
-        case PANEL_ALBUMS:
-            get_songs(app_state->connection, app_state->db, artist->id,
-                      album->id);
-            for (int i = 0; i < album->number_songs; i++) {
-                song = &album->songs[i];
-                add_song(song, playlist);
-            }
-            break;
-        case PANEL_SONGS:
-            song = &album->songs[app_state->selected_song_idx];
-            add_song(song, playlist);
-            break;
-        default:
-            break;
+    pthread_mutex_lock(&notifier->lock);
+    notifier->stopping = 1;
+    pthread_cond_signal(&notifier->cond);
+    pthread_mutex_unlock(&notifier->lock);
+
+    if (notifier->started) {
+        pthread_join(notifier->thread, NULL);
+        notifier->started = 0;
     }
-    return has_songs ?  first_song_to_play : 0;
+    free(notifier->summary);
+    free(notifier->text);
+    notifier->summary = NULL;
+    notifier->text = NULL;
 }
 
 /**
@@ -1958,11 +7193,57 @@ void cleanup(AppState *app_state)
         return;
     }
 
-    // Make the playlist Song pointers point to NULL to avoid problems when we delete the underlying data
-    for (int i = 0; i < app_state->playlist->size; i++) {
-        app_state->playlist->songs[i] = NULL;
+    // Write the last state before exiting
+    stop_control();
+    stop_publisher();
+    stop_notifier();
+    bus_close(&session_bus);
+
+    for (int i = 0; i < number_connections; i++) {
+        for (int j = 0; j < NUMBER_OPERATIONS; j++) {
+            free(connections[i].requests[j]);
+        }
+        pthread_mutex_destroy(&connections[i].bandwidth->lock);
+        free(connections[i].bandwidth);
+    }
+
+    // Release the playlist before the songs it points to are deleted,
+    // once the journal has been written so clearing it is not recorded
+    close_journal(app_state->playlist);
+    clear_songs(app_state->playlist);
+    free(app_state->playlist->nodes);
+    free(app_state->playlist->shuffle.upcoming);
+    free(app_state->playlist->shuffle.position);
+    free(app_state->playlist->shuffle.history);
+
+    // Clean the named playlists and the songs known only from them
+    for (int i = 0; i < app_state->number_playlists; i++) {
+        NamedPlaylist *const named = &app_state->playlists[i];
+
+        for (int j = 0; j < named->number_synced; j++) {
+            free(named->synced[j]);
+        }
+        free(named->synced);
+        free(named->id);
+        free(named->name);
+        free(named->songs.nodes);
+        free(named->songs.shuffle.upcoming);
+        free(named->songs.shuffle.position);
+        free(named->songs.shuffle.history);
+    }
+    free(app_state->playlists);
+    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+        while (song_table[i] != NULL) {
+            SongEntry *const entry = song_table[i];
+
+            song_table[i] = entry->next;
+            free(entry->song.id);
+            free(entry->song.name);
+            free(entry->song.artist);
+            free(entry->song.album);
+            free(entry);
+        }
     }
-    free(app_state->playlist->songs);
 
     // Clean the database
     for (int i = 0; i < app_state->db->number_artists; i++) {
@@ -1976,16 +7257,22 @@ void cleanup(AppState *app_state)
 
                 free(song->id);
                 free(song->name);
+                free(song->artist);
+                free(song->album);
+                free_copies(song->copies, song->number_copies);
             }
             free(album->id);
             free(album->name);
             free(album->songs);
+            free_copies(album->copies, album->number_copies);
         }
         free(artist->id);
         free(artist->name);
         free(artist->albums);
+        free_copies(artist->copies, artist->number_copies);
     }
     free(app_state->db->artists);
+    free(connections);
 }
 
 /**
@@ -1994,28 +7281,10 @@ void cleanup(AppState *app_state)
  * @param database Pointer to the database containing the artist, album, and song data.
  * @param song Pointer to the song for which to retrieve the artist and album information.
  * @return A SongInfo struct containing pointers to the artist and album of the given song.
- *         If the song is not found in any album, both artist and album pointers will be NULL.
  */
 SongInfo get_song_info(const Database *const database, const Song *const song) {
-    SongInfo song_info = { NULL, NULL };
-
-    for (int i = 0; i < database->number_artists; i++) {
-        const Artist *const artist = &database->artists[i];
-
-        for (int j = 0; j < artist->number_albums; j++) {
-            const Album *const album = &artist->albums[j];
-
-            for (int k = 0; k < album->number_songs; k++) {
-                if (strcmp(album->songs[k].id, song->id) == 0) {
-                    song_info.artist = artist->name;
-                    song_info.album = album->name;
-                    return song_info;
-                }
-            }
-        }
-    }
-
-    return song_info;  // Song not found in any album
+    // Songs carry the names of their artist and album, so no lookup is needed
+    return (SongInfo) { song->artist, song->album };
 }
 
 /**
@@ -2043,7 +7312,7 @@ void print_progress_bar(WINDOW **windows, const AppState *const app_state)
         return;
     }
     // Retrieve the current song and its duration
-    const Song *const song = playlist->songs[playlist->current_playing];
+    const Song *const song = playlist_song(playlist, playlist->current_playing);
     const int duration = song->duration;
 
     // Compute the progress bar width based on the window width
@@ -2117,7 +7386,7 @@ void update_playlist_state(AppState *app_state)
             }
             break;
         case SHUFFLE:
-            playlist->current_playing = rand() % playlist_size;
+            playlist->current_playing = shuffle_next(playlist);
             break;
         case REPEAT:
             break;
@@ -2233,12 +7502,13 @@ void handle_action(const int action, AppState *app_state)
             }
         case add_and_play:
             if (app_state->current_view == VIEW_INFO) {
-                const int first_song_to_play = add_to_playlist(app_state);
+                const int first_song_to_play =
+                    add_to_playlist(app_state, playlist);
 
                 play_song(app_state, first_song_to_play);
             }
             if (app_state->current_view == VIEW_PLAYLIST) {
-                play_song(app_state, playlist->selected_song_idx);
+                play_viewed_playlist(app_state);
                 refresh_windows(app_state, playlist_windows, 1);
             }
             break;
@@ -2255,24 +7525,83 @@ void handle_action(const int action, AppState *app_state)
         case shuffle:
         case repeat:
             change_shuffle_repeat(playlist, action);
+            dump(app_state);
             break;
         case add:
-            add_to_playlist(app_state);
+            add_to_playlist(app_state, viewed_playlist(app_state));
+            if (app_state->current_view == VIEW_INFO) {
+                refresh_windows(app_state, info_windows, NUM_PANELS);
+            }
             break;
         case remove_one:
             if (app_state->current_view == VIEW_PLAYLIST) {
-                delete_song(app_state);
+                int first;
+                int last;
+
+                selection_range(app_state, &first, &last);
+                delete_songs(app_state, first, last - first + 1);
+                viewed_playlist(app_state)->selected_song_idx =
+                    MIN(first, viewed_playlist(app_state)->size - 1);
+                app_state->selection_anchor = -1;
                 refresh_windows(app_state, playlist_windows, 1);
             }
             break;
-        case remove_all:
+        case visual:
+            toggle_selection(app_state);
+            if (app_state->current_view == VIEW_INFO) {
+                refresh_windows(app_state, info_windows, NUM_PANELS);
+            } else {
+                refresh_windows(app_state, playlist_windows, 1);
+            }
+            break;
+        case move_up:
+        case move_down:
+            if (app_state->current_view == VIEW_PLAYLIST) {
+                move_selection(app_state, action);
+                refresh_windows(app_state, playlist_windows, 1);
+            }
+            break;
+        case next_playlist:
+        case previous_playlist:
+            if (app_state->current_view == VIEW_PLAYLIST) {
+                switch_playlist(app_state, action == next_playlist ? 1 : -1);
+                refresh_windows(app_state, playlist_windows, 1);
+            }
+            break;
+        case save_playlist:
+            if (app_state->current_view == VIEW_PLAYLIST
+                && app_state->viewed_playlist >= 0) {
+                sync_playlist(app_state->connection,
+                              &app_state->playlists[app_state->viewed_playlist]);
+                refresh_windows(app_state, playlist_windows, 1);
+            }
+            break;
+        case new_playlist:
             if (app_state->current_view == VIEW_PLAYLIST) {
-                while (playlist->size > 0) {
-                    delete_song(app_state);
+                char name[MAX_QUERY_LENGTH] = { 0 };
+
+                if (prompt_text(app_state, "Playlist name: ", name, sizeof(name)) == 0
+                    && name[0] != '\0') {
+                    app_state->viewed_playlist =
+                        create_named_playlist(app_state, name,
+                                              viewed_playlist(app_state));
+                    app_state->selection_anchor = -1;
                 }
                 refresh_windows(app_state, playlist_windows, 1);
             }
             break;
+        case remove_all:
+            if (app_state->current_view == VIEW_PLAYLIST) {
+                clear_playlist(app_state);
+                refresh_windows(app_state, playlist_windows, 1);
+            }
+            break;
+        case crop:
+            if (app_state->current_view == VIEW_PLAYLIST) {
+                crop_playlist(app_state);
+                refresh_windows(app_state, playlist_windows, 1);
+            }
+            break;
         case play_pause:
             pause_resume(app_state);
             break;
@@ -2281,6 +7610,7 @@ void handle_action(const int action, AppState *app_state)
             break;
         case main_view:
             if (app_state->current_view == VIEW_PLAYLIST) {
+                app_state->selection_anchor = -1;
                 endwin();
                 delete_windows(playlist_windows, 1);
                 playlist_windows[0] = NULL;
@@ -2297,6 +7627,7 @@ void handle_action(const int action, AppState *app_state)
             break;
         case playlist_view:
             if (app_state->current_view == VIEW_INFO) {
+                app_state->selection_anchor = -1;
                 endwin();
                 delete_windows(info_windows, NUM_PANELS);
 
@@ -2340,6 +7671,10 @@ void handle_action(const int action, AppState *app_state)
             }
             break;
         case quit:
+            log_position(app_state->playlist);
+            if (sync_play_queue) {
+                save_play_queue(app_state);
+            }
             if (app_state->playlist->status == PLAYING) {
                 kill(get_pid(app_state->program), SIGTERM);
             }
@@ -2370,6 +7705,9 @@ int main(void)
 {
     setlocale(LC_ALL, "");
 
+    // Writing to a playback program that already exited must not kill us
+    signal(SIGPIPE, SIG_IGN);
+
     setup_ncurses();
     WINDOW **playlist_windows =
         create_windows(1, bottom_space, WINDOW_PLAYLIST);
@@ -2378,24 +7716,45 @@ int main(void)
     WINDOW **playback_windows =
         create_windows(1, bottom_space, WINDOW_PLAYBACK);
 
+    init_connections();
+
     Database db = init_db();
     Playlist playlist = init_playlist();
     AppState app_state = init_appstate();
 
     app_state.playlist = &playlist;
 
-    get_artists(app_state.connection, &db);
+    if (get_library(&db) != 0) {
+        fprintf(stderr,
+                "Error: Failed to retrieve artists from Subsonic server/\n");
+        exit(EXIT_FAILURE);
+    }
     Artist *artist = &(db.artists[app_state.selected_artist_idx]);
 
     app_state.artist = artist;
 
-    get_albums(app_state.connection, &db, artist->id);
+    get_albums(&db, artist->id);
     Album *album = &(artist->albums[app_state.selected_album_idx]);
 
     app_state.album = album;
 
-    get_songs(app_state.connection, &db, artist->id, album->id);
+    get_songs(&db, artist->id, album->id);
     app_state.db = &db;
+    get_playlists(&app_state);
+
+    // Restore the queue of the previous session
+    if (queue_journal != NULL) {
+        open_journal(&playlist, queue_journal);
+    }
+    if (sync_play_queue && playlist.size == 0) {
+        get_play_queue(&app_state);
+    }
+    if (control_socket != NULL) {
+        start_control(app_state.connection, control_socket);
+    }
+    if (enable_mpris) {
+        start_mpris();
+    }
 
     app_state.windows[WINDOW_INFO] = info_windows;
     app_state.windows[WINDOW_PLAYLIST] = playlist_windows;
@@ -2418,10 +7777,16 @@ int main(void)
                 // Check if current song has finished playing
                 if (playlist.current_playing < playlist.size
                     && playlist.play_time >=
-                    playlist.songs[playlist.current_playing]->duration) {
+                    playlist_song(&playlist, playlist.current_playing)->duration) {
                     update_playlist_state(&app_state);
                 }
                 playlist.start_time = now;
+                observe_stream(playlist.play_time);
+                if (playlist.journal != NULL
+                    && abs(playlist.play_time - playlist.journal->logged_position)
+                    >= journal_position_interval) {
+                    log_position(&playlist);
+                }
                 print_progress_bar(playback_windows, &app_state);
                 break;
             case PAUSED:
@@ -2432,9 +7797,27 @@ int main(void)
             default:
                 break;
         }
-        c = getch();
-        action = get_action(c);
-        handle_action(action, &app_state);
+
+        // Wait for a key, for commands from the control socket or for D-Bus calls
+        struct pollfd fds[3] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = control_server.wakeup[0], .events = POLLIN },
+            { .fd = session_bus.fd, .events = POLLIN },
+        };
+        const int ready = poll(fds, 3, 500);
+
+        if (fds[1].revents & POLLIN) {
+            process_control_commands(&app_state);
+        }
+        if (fds[2].revents) {
+            process_bus(&app_state);
+        }
+        // A signal such as SIGWINCH interrupts the wait, let ncurses report it
+        if (ready < 0 || fds[0].revents) {
+            c = getch();
+            action = get_action(c);
+            handle_action(action, &app_state);
+        }
     }
     return 0;
 }